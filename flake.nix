@@ -18,6 +18,8 @@
 				nativeBuildInputs = with pkgs; [
 					cmake
 					libseccomp
+					pkg-config
+					zstd
 				];
 			};
 		in {
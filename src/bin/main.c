@@ -2,7 +2,20 @@
 
 #include "copycat.h"
 #include "ld_preload.h"
+#include "seccomp/file_cache.h"
+#include "seccomp/memfd_cache.h"
+#include "seccomp/overlay.h"
+#include "seccomp/resolver.h"
 #include "seccomp/seccomp_exec.h"
+#include "seccomp/stats.h"
+
+// the options that only take effect in a supervisor of our own, see seccomp_set_supervisor_options()
+static char supervisor_options[128] = "";
+
+static void add_supervisor_option(const char *name) {
+	const size_t len = strlen(supervisor_options);
+	snprintf(supervisor_options + len, sizeof(supervisor_options) - len, "%s--%s", len ? " " : "", name);
+}
 
 void show_usage() {
 	printf("Usage: copycat /path/to/program\n");
@@ -17,9 +30,15 @@ int main(int argc, char *argv[])
 	static struct option long_opts[] = {
 		{ "help", no_argument, NULL, 'h' },
 		{ "no-seccomp", no_argument, NULL, 'n' },
+		{ "memory-budget", required_argument, NULL, 'm' },
+		{ "cache-dir", required_argument, NULL, 'c' },
+		{ "resolver", required_argument, NULL, 'r' },
+		{ "stats", no_argument, NULL, 's' },
+		{ "batch", no_argument, NULL, 'b' },
+		{ "keep-overlay", no_argument, NULL, 'k' },
 		{ NULL, 0, NULL, 0 }
 	};
-	while ((opt = getopt_long(argc, argv, "hn", long_opts, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "hnm:c:r:sbk", long_opts, NULL)) != -1) {
 		switch (opt) {
 		case 'h':
 			show_help = true;
@@ -27,6 +46,32 @@ int main(int argc, char *argv[])
 		case 'n':
 			use_seccomp = false;
 			break;
+		case 'm':
+			// given in MiB
+			memfd_cache_set_budget(strtoull(optarg, NULL, 10) << 20);
+			add_supervisor_option("memory-budget");
+			break;
+		case 'c':
+			file_cache_set_dir(optarg);
+			add_supervisor_option("cache-dir");
+			break;
+		case 'r':
+			if (resolver_load(optarg) < 0) {
+				return EXIT_FAILURE;
+			}
+			break;
+		case 's':
+			stats.enabled = true;
+			add_supervisor_option("stats");
+			break;
+		case 'b':
+			seccomp_set_batch(true);
+			add_supervisor_option("batch");
+			break;
+		case 'k':
+			overlay_set_keep(true);
+			add_supervisor_option("keep-overlay");
+			break;
 		case '?':
 			show_help = true;
 			break;
@@ -45,6 +90,7 @@ int main(int argc, char *argv[])
 		char **const program_args = argv + optind;
 		if (use_seccomp) {
 			// seccomp
+			seccomp_set_supervisor_options(supervisor_options);
 			status_code = seccomp_exec(program, program_args);
 		} else {
 			// LD_PRELOAD
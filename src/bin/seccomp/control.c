@@ -0,0 +1,197 @@
+#include "control.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// how long a nested instance waits for the supervisor to answer, before it gives up and supervises on its own
+#define CONTROL_TIMEOUT_SEC 5
+// how many parent processes are searched for the supervisor
+#define MAX_CONTROL_DEPTH 64
+
+int control_open(int *child_fd) {
+	int sk_pair[2];
+	if (socketpair(PF_LOCAL, SOCK_SEQPACKET, 0, sk_pair) < 0) {
+		perror("socketpair");
+		return -1;
+	}
+	// the kernel attaches the credentials of the sender to every message, so we know which process wants to join
+	const int one = 1;
+	if (setsockopt(sk_pair[0], SOL_SOCKET, SO_PASSCRED, &one, sizeof(one)) < 0) {
+		perror("setsockopt(SO_PASSCRED)");
+		close(sk_pair[0]);
+		close(sk_pair[1]);
+		return -1;
+	}
+	// only the end for the supervised processes is inherited across exec
+	fcntl(sk_pair[0], F_SETFD, FD_CLOEXEC);
+	char fd[16];
+	snprintf(fd, sizeof(fd), "%d", sk_pair[1]);
+	setenv(COPYCAT_CONTROL_ENV, fd, 1);
+	*child_fd = sk_pair[1];
+	return sk_pair[0];
+}
+
+// Returns true if pid is one of the parent processes of this process
+static bool is_ancestor(pid_t pid) {
+	char path[64], buf[512];
+	pid_t ppid = getppid();
+	for (size_t depth = 0; ppid > 1 && depth < MAX_CONTROL_DEPTH; ++depth) {
+		if (ppid == pid) {
+			return true;
+		}
+		snprintf(path, sizeof(path), "/proc/%d/stat", ppid);
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			return false;
+		}
+		ssize_t len = read(fd, buf, sizeof(buf) - 1);
+		close(fd);
+		if (len <= 0) {
+			return false;
+		}
+		buf[len] = '\0';
+		// the command name may contain spaces and parentheses, the parent pid follows the state after it
+		const char *comm_end = strrchr(buf, ')');
+		if (comm_end == NULL || sscanf(comm_end + 1, " %*c %d", &ppid) != 1) {
+			return false;
+		}
+	}
+	return false;
+}
+
+/*
+ * Returns true if sk is a control socket created by a copycat instance that supervises this process
+ * The file descriptor number comes from the environment, which may be stale or inherited from somewhere else.
+ */
+static bool control_socket_valid(int sk) {
+	struct stat st;
+	int type, domain;
+	struct ucred cred;
+	socklen_t len = sizeof(type);
+	if (fstat(sk, &st) < 0 || !S_ISSOCK(st.st_mode)
+		|| getsockopt(sk, SOL_SOCKET, SO_TYPE, &type, &len) < 0 || type != SOCK_SEQPACKET) {
+		return false;
+	}
+	len = sizeof(domain);
+	if (getsockopt(sk, SOL_SOCKET, SO_DOMAIN, &domain, &len) < 0 || domain != AF_UNIX) {
+		return false;
+	}
+	// for a socket pair, these are the credentials of the supervisor that created it
+	len = sizeof(cred);
+	if (getsockopt(sk, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+		return false;
+	}
+	return cred.uid == getuid() && is_ancestor(cred.pid);
+}
+
+bool control_join(const char *rules) {
+	const char *env = getenv(COPYCAT_CONTROL_ENV);
+	if (env == NULL) {
+		// we are not supervised by copycat
+		return false;
+	}
+	char *end;
+	const long sk = strtol(env, &end, 10);
+	const size_t len = strlen(rules) + 1;
+	if (!*env || *end || sk < 0 || sk > INT_MAX || len > MAX_CONTROL_MSG_SIZE || !control_socket_valid((int) sk)) {
+		return false;
+	}
+
+	// the answer comes back on a private socket, as other nested instances may share the control socket
+	int reply[2];
+	if (socketpair(PF_LOCAL, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, reply) < 0) {
+		return false;
+	}
+	// never hang if the supervisor does not answer
+	const struct timeval timeout = { .tv_sec = CONTROL_TIMEOUT_SEC };
+	setsockopt(reply[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	struct msghdr msg = {};
+	char buf[CMSG_SPACE(sizeof(int))] = {0};
+	struct iovec io = {
+		.iov_base = (void *) rules,
+		.iov_len = len,
+	};
+	msg.msg_iov = &io;
+	msg.msg_iovlen = 1;
+	msg.msg_control = buf;
+	msg.msg_controllen = sizeof(buf);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	*((int *) CMSG_DATA(cmsg)) = reply[1];
+
+	char accepted = 0;
+	if (sendmsg(sk, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) >= 0) {
+		// the supervisor holds the only other copy of the reply socket now
+		close(reply[1]);
+		reply[1] = -1;
+		if (recv(reply[0], &accepted, sizeof(accepted), 0) != sizeof(accepted)) {
+			accepted = 0;
+		}
+	}
+	close(reply[0]);
+	if (reply[1] >= 0) {
+		close(reply[1]);
+	}
+	return accepted == 1;
+}
+
+int control_recv(int sk, pid_t *pid, char *buf, size_t size) {
+	struct msghdr msg = {};
+	char control[CMSG_SPACE(sizeof(struct ucred)) + CMSG_SPACE(sizeof(int))] = {0};
+	struct iovec io = {
+		.iov_base = buf,
+		.iov_len = size,
+	};
+	msg.msg_iov = &io;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ssize_t len = recvmsg(sk, &msg, MSG_CMSG_CLOEXEC);
+	if (len <= 0) {
+		return -1;
+	}
+
+	int reply = -1;
+	*pid = 0;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET) {
+			continue;
+		}
+		if (cmsg->cmsg_type == SCM_RIGHTS) {
+			memcpy(&reply, CMSG_DATA(cmsg), sizeof(reply));
+		} else if (cmsg->cmsg_type == SCM_CREDENTIALS) {
+			struct ucred cred;
+			memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+			*pid = cred.pid;
+		}
+	}
+	if (reply < 0) {
+		return -1;
+	}
+	if (*pid <= 0 || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+		// we do not know who this is, or could not receive all rules
+		control_reply(reply, false);
+		return -1;
+	}
+	buf[len - 1] = '\0';
+	return reply;
+}
+
+void control_reply(int reply, bool accepted) {
+	const char answer = accepted;
+	if (send(reply, &answer, sizeof(answer), MSG_NOSIGNAL) < 0) {
+		perror("send");
+	}
+	close(reply);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <sys/types.h>
+
+// the environment variable that tells nested copycat instances how to reach the supervisor
+#define COPYCAT_CONTROL_ENV "COPYCAT_CONTROL_FD"
+// the maximum size of the rules that a nested instance can hand over
+#define MAX_CONTROL_MSG_SIZE (64 * 1024)
+
+/**
+ * Creates the control socket, over which nested copycat instances hand their rules to this supervisor
+ *
+ * The end for the supervised processes is exported in the COPYCAT_CONTROL_FD environment variable and stored in child_fd,
+ * it needs to be closed in the supervisor after forking.
+ * Returns the end for the supervisor or -1 on error.
+ */
+int control_open(int *child_fd);
+
+/**
+ * Asks the copycat instance that supervises this process to apply rules to this process and all of its descendants
+ *
+ * The socket in COPYCAT_CONTROL_FD is only used if it was created by a parent process of the same user,
+ * and the supervisor is given a few seconds to answer.
+ * Returns true if the supervisor took over the rules, so that no other supervisor needs to be stacked.
+ */
+bool control_join(const char *rules);
+
+/**
+ * Receives rules from a nested instance on the supervisor end sk into buf
+ *
+ * pid is set to the process id of the nested instance, as verified by the kernel.
+ * Returns the socket to send the answer to with control_reply(), or -1 on error.
+ */
+int control_recv(int sk, pid_t *pid, char *buf, size_t size);
+
+/**
+ * Tells the nested instance whether its rules were taken over, and closes the reply socket
+ */
+void control_reply(int reply, bool accepted);
@@ -0,0 +1,31 @@
+#include "copy.h"
+
+#include <errno.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+// copy in chunks of at most this many bytes per system call
+#define COPY_CHUNK_SIZE (1L << 30)
+
+int copy_file(int src, int dst) {
+	if (ioctl(dst, FICLONE, src) == 0) {
+		return 0;
+	}
+
+	ssize_t n;
+	while ((n = copy_file_range(src, NULL, dst, NULL, COPY_CHUNK_SIZE, 0)) > 0) {
+	}
+	if (n == 0) {
+		return 0;
+	}
+	if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP) {
+		return -1;
+	}
+
+	// copy_file_range is not supported here, both file offsets are still consistent though
+	while ((n = sendfile(dst, src, NULL, COPY_CHUNK_SIZE)) > 0) {
+	}
+	return n == 0 ? 0 : -1;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#define _GNU_SOURCE
+
+/**
+ * Copies the whole content of the regular file src into dst
+ *
+ * A reflink is tried first, so that filesystems supporting it share the data blocks instead of copying them.
+ * Otherwise the data is copied in the kernel with copy_file_range, falling back to sendfile across filesystems that do not support it.
+ * Returns 0 on success or -1 with errno set.
+ */
+int copy_file(int src, int dst);
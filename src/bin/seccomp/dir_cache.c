@@ -0,0 +1,213 @@
+#include "dir_cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <linux/limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define DIR_CACHE_SIZE 16
+
+// the record format of getdents64, glibc does not export it
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+struct dir_entry {
+	uint64_t ino;
+	unsigned char type;
+	char *name;
+};
+
+struct dir_cache_entry {
+	char source[PATH_MAX];
+	char dest[PATH_MAX];
+	// the modification times of both directories, a new entry changes them
+	struct timespec source_mtime;
+	struct timespec dest_mtime;
+	unsigned long last_use;
+	// whether this entry holds a listing
+	bool valid;
+	struct dir_listing listing;
+};
+
+static struct dir_cache_entry cache[DIR_CACHE_SIZE];
+static unsigned long tick = 0;
+
+static bool same_time(const struct timespec *a, const struct timespec *b) {
+	return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+static int compare_entries(const void *a, const void *b) {
+	return strcmp(((const struct dir_entry *) a)->name, ((const struct dir_entry *) b)->name);
+}
+
+static void free_entries(struct dir_entry *entries, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		free(entries[i].name);
+	}
+	free(entries);
+}
+
+/*
+ * Reads all entries of the directory path, sorted by name
+ * If skip_dots is set, the "." and ".." entries are left out.
+ */
+static struct dir_entry *read_entries(const char *path, bool skip_dots, size_t *count) {
+	DIR *dir = opendir(path);
+	if (dir == NULL) {
+		return NULL;
+	}
+	size_t capacity = 64;
+	struct dir_entry *entries = malloc(capacity * sizeof(*entries));
+	*count = 0;
+	struct dirent *d;
+	while (entries != NULL && (d = readdir(dir)) != NULL) {
+		if (skip_dots && (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))) {
+			continue;
+		}
+		if (*count == capacity) {
+			capacity *= 2;
+			struct dir_entry *grown = realloc(entries, capacity * sizeof(*entries));
+			if (grown == NULL) {
+				free_entries(entries, *count);
+				entries = NULL;
+				break;
+			}
+			entries = grown;
+		}
+		entries[*count] = (struct dir_entry) { d->d_ino, d->d_type, strdup(d->d_name) };
+		(*count)++;
+	}
+	closedir(dir);
+	if (entries != NULL) {
+		qsort(entries, *count, sizeof(*entries), compare_entries);
+	}
+	return entries;
+}
+
+static size_t record_size(const char *name) {
+	// records are aligned to 8 bytes
+	return (offsetof(struct linux_dirent64, d_name) + strlen(name) + 1 + 7) & ~(size_t) 7;
+}
+
+static void free_listing(struct dir_listing *listing) {
+	free(listing->records);
+	free(listing->offsets);
+	*listing = (struct dir_listing) {};
+}
+
+/*
+ * Merges the sorted entries of source and dest into listing, dest wins for duplicate names
+ */
+static bool build_listing(struct dir_listing *listing, struct dir_entry *src, size_t src_count, struct dir_entry *dst, size_t dst_count) {
+	// first pass to find the size of the merged listing
+	struct dir_entry **merged = malloc((src_count + dst_count) * sizeof(*merged) + 1);
+	if (merged == NULL) {
+		return false;
+	}
+	size_t count = 0, size = 0, i = 0, j = 0;
+	while (i < src_count || j < dst_count) {
+		int cmp = i == src_count ? 1 : j == dst_count ? -1 : strcmp(src[i].name, dst[j].name);
+		if (cmp < 0) {
+			merged[count] = &src[i++];
+		} else {
+			if (cmp == 0) {
+				// shadowed by the destination
+				i++;
+			}
+			merged[count] = &dst[j++];
+		}
+		size += record_size(merged[count++]->name);
+	}
+
+	listing->records = calloc(1, size + 1);
+	listing->offsets = malloc((count + 1) * sizeof(*listing->offsets));
+	if (listing->records == NULL || listing->offsets == NULL) {
+		free(merged);
+		free_listing(listing);
+		return false;
+	}
+
+	// second pass to write the records
+	size_t pos = 0;
+	for (size_t k = 0; k < count; ++k) {
+		struct linux_dirent64 *d = (struct linux_dirent64 *) (listing->records + pos);
+		d->d_ino = merged[k]->ino;
+		d->d_off = k + 1;
+		d->d_reclen = record_size(merged[k]->name);
+		d->d_type = merged[k]->type;
+		strcpy(d->d_name, merged[k]->name);
+		listing->offsets[k] = pos;
+		pos += d->d_reclen;
+	}
+	listing->offsets[count] = pos;
+	listing->size = size;
+	listing->count = count;
+	free(merged);
+	return true;
+}
+
+const struct dir_listing *dir_cache_get(const char *source, const char *dest) {
+	struct stat src_st, dst_st;
+	if (stat(source, &src_st) < 0 || stat(dest, &dst_st) < 0) {
+		return NULL;
+	}
+	if (strlen(source) >= PATH_MAX || strlen(dest) >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	// two stats are all it takes if the listing is still up to date
+	struct dir_cache_entry *e = NULL, *lru = &cache[0];
+	for (size_t i = 0; i < DIR_CACHE_SIZE; ++i) {
+		if (cache[i].valid && !strcmp(cache[i].source, source) && !strcmp(cache[i].dest, dest)) {
+			e = &cache[i];
+			break;
+		}
+		if (lru->valid && (!cache[i].valid || cache[i].last_use < lru->last_use)) {
+			lru = &cache[i];
+		}
+	}
+	if (e != NULL && same_time(&e->source_mtime, &src_st.st_mtim) && same_time(&e->dest_mtime, &dst_st.st_mtim)) {
+		e->last_use = ++tick;
+		return &e->listing;
+	}
+	if (e == NULL) {
+		e = lru;
+	}
+
+	// (re)build the listing
+	if (e->valid) {
+		free_listing(&e->listing);
+		e->valid = false;
+	}
+	size_t src_count = 0, dst_count = 0;
+	struct dir_entry *src = read_entries(source, false, &src_count);
+	struct dir_entry *dst = read_entries(dest, true, &dst_count);
+	bool ok = src != NULL && dst != NULL && build_listing(&e->listing, src, src_count, dst, dst_count);
+	if (src != NULL) {
+		free_entries(src, src_count);
+	}
+	if (dst != NULL) {
+		free_entries(dst, dst_count);
+	}
+	if (!ok) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	strcpy(e->source, source);
+	strcpy(e->dest, dest);
+	e->source_mtime = src_st.st_mtim;
+	e->dest_mtime = dst_st.st_mtim;
+	e->last_use = ++tick;
+	e->valid = true;
+	return &e->listing;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#define _GNU_SOURCE
+#include <stddef.h>
+
+/**
+ * A merged directory listing in the getdents64 format
+ *
+ * The d_off of every record is the index of the next record, so that the file offset of the directory can be used as cursor.
+ */
+struct dir_listing {
+	char *records;
+	size_t size;
+	// byte offset of each record in records, plus one past the last record
+	size_t *offsets;
+	size_t count;
+};
+
+/**
+ * Returns the merged listing of the directories source and dest
+ *
+ * Entries that exist in both directories are taken from dest.
+ * Listings are cached per source directory and only rebuilt once one of the directories was modified.
+ * Returns NULL and sets errno on error.
+ */
+const struct dir_listing *dir_cache_get(const char *source, const char *dest);
@@ -0,0 +1,93 @@
+#include "fd_cache.h"
+
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FD_CACHE_SIZE 64
+
+struct fd_cache_entry {
+	pid_t pid;
+	int fd;
+	dev_t dev;
+	ino_t ino;
+	// renaming a directory keeps its inode, but updates its ctime, whereas renaming one of its parents does not
+	struct timespec ctime;
+	// whether the last lookup read path from the link, instead of taking it from the cache
+	bool resolved;
+	char path[PATH_MAX];
+};
+static struct fd_cache_entry cache[FD_CACHE_SIZE];
+
+static size_t fd_cache_slot(pid_t pid, int fd) {
+	return ((size_t) pid * 31 + (size_t) fd) % FD_CACHE_SIZE;
+}
+
+// Writes the path of the link in /proc that refers to the file descriptor fd of the task pid to link
+static void fd_link(char link[64], pid_t pid, int fd) {
+	if (fd == AT_FDCWD) {
+		snprintf(link, 64, "/proc/%d/cwd", pid);
+	} else {
+		snprintf(link, 64, "/proc/%d/fd/%d", pid, fd);
+	}
+}
+
+const char *fd_cache_lookup(pid_t pid, int fd) {
+	char link[64];
+	fd_link(link, pid, fd);
+
+	// a single stat tells whether the descriptor changed, but not whether one of the parents was renamed, see fd_cache_current()
+	struct stat st;
+	if (stat(link, &st) < 0 || st.st_nlink == 0) {
+		return NULL;
+	}
+
+	struct fd_cache_entry *e = &cache[fd_cache_slot(pid, fd)];
+	if (e->pid == pid && e->fd == fd && e->dev == st.st_dev && e->ino == st.st_ino
+		&& e->ctime.tv_sec == st.st_ctim.tv_sec && e->ctime.tv_nsec == st.st_ctim.tv_nsec) {
+		e->resolved = false;
+		return e->path;
+	}
+
+	// cache miss, resolve the path for real
+	e->pid = 0;
+	ssize_t len = readlink(link, e->path, sizeof(e->path) - 1);
+	if (len < 0) {
+		return NULL;
+	}
+	e->path[len] = '\0';
+	// pipes, sockets and other anonymous objects do not have a usable path
+	if (e->path[0] != '/') {
+		return NULL;
+	}
+
+	e->pid = pid;
+	e->fd = fd;
+	e->dev = st.st_dev;
+	e->ino = st.st_ino;
+	e->ctime = st.st_ctim;
+	e->resolved = true;
+	return e->path;
+}
+
+bool fd_cache_current(pid_t pid, int fd) {
+	struct fd_cache_entry *e = &cache[fd_cache_slot(pid, fd)];
+	if (e->pid != pid || e->fd != fd || e->resolved) {
+		// not cached, or read from the link just now
+		return true;
+	}
+	char link[64], path[PATH_MAX];
+	fd_link(link, pid, fd);
+	ssize_t len = readlink(link, path, sizeof(path) - 1);
+	if (len >= 0) {
+		path[len] = '\0';
+		if (!strcmp(path, e->path)) {
+			return true;
+		}
+	}
+	e->pid = 0;
+	return false;
+}
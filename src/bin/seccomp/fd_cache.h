@@ -0,0 +1,24 @@
+#pragma once
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * Returns the absolute path that the file descriptor fd of the task pid refers to
+ *
+ * If fd is AT_FDCWD, the current working directory of the task is returned instead.
+ * Results are cached per task and file descriptor. A cached entry is only reused if it still refers to the same inode,
+ * so the expensive path lookup is only done when the task changed the descriptor in the meantime.
+ * Renaming a parent directory does not change the inode, so the returned path may be stale, see fd_cache_current().
+ * Returns NULL if the descriptor does not refer to an object with a path.
+ */
+const char *fd_cache_lookup(pid_t pid, int fd);
+
+/**
+ * Returns true if the path that fd_cache_lookup() returned for the file descriptor fd of the task pid is still current
+ *
+ * This costs the path lookup that the cache saves otherwise, so it is only done before the path redirects anything.
+ * Stale entries are dropped, so that the next fd_cache_lookup() returns the current path.
+ */
+bool fd_cache_current(pid_t pid, int fd);
@@ -0,0 +1,140 @@
+#include "file_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "copy.h"
+#include "util.h"
+
+static char cache_dir[PATH_MAX] = "";
+
+void file_cache_set_dir(const char *dir) {
+	snprintf(cache_dir, sizeof(cache_dir), "%s", dir);
+}
+
+static bool file_cache_init() {
+	if (!*cache_dir) {
+		const char *xdg = getenv("XDG_CACHE_HOME");
+		const char *home = getenv("HOME");
+		if (xdg != NULL && *xdg) {
+			snprintf(cache_dir, sizeof(cache_dir), "%s/copycat", xdg);
+		} else if (home != NULL && *home) {
+			snprintf(cache_dir, sizeof(cache_dir), "%s/.cache/copycat", home);
+		} else {
+			return false;
+		}
+	}
+	if (make_dirs(cache_dir, 0700) < 0) {
+		perror(cache_dir);
+		return false;
+	}
+	return true;
+}
+
+static bool cached_copy_valid(const char *cached, const struct stat *st) {
+	struct stat cst;
+	return stat(cached, &cst) == 0 && cst.st_size == st->st_size
+		&& cst.st_mtim.tv_sec == st->st_mtim.tv_sec && cst.st_mtim.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/*
+ * Copies the original file at path relative to dirfd into the cache at the location cached
+ * The copy is created under a temporary name first, so that no one ever sees a partial copy.
+ */
+static int fill_cache(int dirfd, const char *path, const char *cached, const struct stat *st) {
+	int src = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+	if (src < 0) {
+		return -1;
+	}
+	struct stat sst;
+	if (fstat(src, &sst) < 0 || sst.st_dev != st->st_dev || sst.st_ino != st->st_ino) {
+		// the original was replaced in the meantime
+		close(src);
+		errno = ESTALE;
+		return -1;
+	}
+
+	char tmp[PATH_MAX + 8];
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", cached);
+	int dst = mkostemp(tmp, O_CLOEXEC);
+	if (dst < 0) {
+		close(src);
+		return -1;
+	}
+
+	// the modification time of the copy tells us which version of the original it holds
+	const struct timespec times[2] = { sst.st_atim, sst.st_mtim };
+	int ret = 0;
+	if (copy_file(src, dst) < 0 || futimens(dst, times) < 0 || rename(tmp, cached) < 0) {
+		int err = errno;
+		unlink(tmp);
+		errno = err;
+		ret = -1;
+	}
+	close(dst);
+	close(src);
+	return ret;
+}
+
+int file_cache_open(int dirfd, const char *path, int flags, mode_t mode) {
+	if ((flags & O_ACCMODE) != O_RDONLY || !file_cache_init()) {
+		return openat(dirfd, path, flags, mode);
+	}
+
+	// a single stat of the original is all it takes on the slow storage when the copy is up to date
+	struct stat st;
+	if (fstatat(dirfd, path, &st, 0) < 0 || !S_ISREG(st.st_mode)) {
+		// only regular files are cached
+		return openat(dirfd, path, flags, mode);
+	}
+
+	// the inode is part of the name, so a replaced original never matches an old copy
+	char cached[PATH_MAX];
+	int len = snprintf(cached, sizeof(cached), "%s/%lx-%lx", cache_dir, (unsigned long) st.st_dev, (unsigned long) st.st_ino);
+	if (len < 0 || (size_t) len >= sizeof(cached)) {
+		// the cache directory path is too long
+		return openat(dirfd, path, flags, mode);
+	}
+
+	bool valid = cached_copy_valid(cached, &st);
+	if (!valid) {
+		// single-flight the copy, only one opener fills the cache, everyone else is served the original in the meantime
+		char lock_path[PATH_MAX + 8];
+		snprintf(lock_path, sizeof(lock_path), "%s.lock", cached);
+		int lock = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		if (lock < 0) {
+			perror(lock_path);
+		} else if (flock(lock, LOCK_EX | LOCK_NB) < 0) {
+			if (errno != EWOULDBLOCK) {
+				perror(lock_path);
+			}
+		} else {
+			valid = cached_copy_valid(cached, &st) || fill_cache(dirfd, path, cached, &st) == 0;
+			if (!valid) {
+				// serve the original instead
+				perror(cached);
+			}
+			// a racing opener may still lock the unlinked file and fill the cache again, which is harmless as the copy is renamed into place
+			unlink(lock_path);
+		}
+		if (lock >= 0) {
+			close(lock);
+		}
+	}
+
+	int fd = -1;
+	if (valid) {
+		fd = open(cached, flags & ~(O_CREAT | O_EXCL | O_TRUNC));
+	}
+	if (fd < 0) {
+		fd = openat(dirfd, path, flags, mode);
+	}
+	return fd;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+
+/**
+ * Sets the local directory that cached copies are stored in
+ *
+ * If unset, $XDG_CACHE_HOME/copycat or ~/.cache/copycat is used.
+ */
+void file_cache_set_dir(const char *dir);
+
+/**
+ * Opens the file at path relative to dirfd through the local cache
+ *
+ * On the first read-only open, the file is copied into the cache directory. This and all later read-only opens are served from the local copy,
+ * as long as the size, modification time and inode of the original file did not change.
+ * Concurrent first opens, even from different copycat instances sharing the cache directory, copy the file only once,
+ * while the others open the original file instead of waiting for the copy.
+ * Opens for writing go to the original file directly.
+ * Returns the new file descriptor, or -1 with errno set.
+ */
+int file_cache_open(int dirfd, const char *path, int flags, mode_t mode);
@@ -0,0 +1,303 @@
+#include "memfd_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define MEMFD_CACHE_SIZE 32
+
+struct memfd_entry {
+	// the memfd holding the decompressed content, or -1 if this entry is unused
+	int memfd;
+	size_t size;
+	// identity of the compressed file, used to detect changes
+	dev_t dev;
+	ino_t ino;
+	off_t compressed_size;
+	struct timespec mtime;
+	// for LRU eviction
+	unsigned long last_use;
+	char path[PATH_MAX];
+};
+
+static struct memfd_entry entries[MEMFD_CACHE_SIZE];
+static bool initialized = false;
+static size_t budget = MEMFD_CACHE_DEFAULT_BUDGET;
+static size_t used = 0;
+static unsigned long tick = 0;
+
+static void memfd_cache_init() {
+	for (size_t i = 0; i < MEMFD_CACHE_SIZE; ++i) {
+		entries[i].memfd = -1;
+	}
+	initialized = true;
+}
+
+static void memfd_cache_evict(struct memfd_entry *e) {
+	close(e->memfd);
+	e->memfd = -1;
+	used -= e->size;
+}
+
+static bool memfd_entry_valid(const struct memfd_entry *e, const char *path, const struct stat *st) {
+	return e->memfd >= 0 && e->dev == st->st_dev && e->ino == st->st_ino && e->compressed_size == st->st_size
+		&& e->mtime.tv_sec == st->st_mtim.tv_sec && e->mtime.tv_nsec == st->st_mtim.tv_nsec && !strcmp(e->path, path);
+}
+
+#ifdef HAVE_ZSTD
+static bool write_all(int fd, const void *buf, size_t len) {
+	const char *p = buf;
+	while (len > 0) {
+		ssize_t w = write(fd, p, len);
+		if (w < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		p += w;
+		len -= w;
+	}
+	return true;
+}
+#endif
+
+/*
+ * Decompresses the file src into a new sealed memfd
+ * Returns the memfd, or -1 on error.
+ */
+static int decompress(int src, const char *path) {
+#ifdef HAVE_ZSTD
+	int memfd = memfd_create("copycat", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd < 0) {
+		perror("memfd_create");
+		return -1;
+	}
+
+	ZSTD_DCtx *dctx = ZSTD_createDCtx();
+	size_t in_size = ZSTD_DStreamInSize();
+	size_t out_size = ZSTD_DStreamOutSize();
+	void *in = malloc(in_size);
+	void *out = malloc(out_size);
+	bool ok = dctx != NULL && in != NULL && out != NULL;
+
+	// this follows the streaming decompression example of zstd
+	size_t last = 0;
+	ssize_t r = 0;
+	while (ok && (r = read(src, in, in_size)) > 0) {
+		ZSTD_inBuffer input = { in, (size_t) r, 0 };
+		while (ok && input.pos < input.size) {
+			ZSTD_outBuffer output = { out, out_size, 0 };
+			last = ZSTD_decompressStream(dctx, &output, &input);
+			if (ZSTD_isError(last)) {
+				fprintf(stderr, "%s: %s\n", path, ZSTD_getErrorName(last));
+				ok = false;
+			} else {
+				ok = write_all(memfd, out, output.pos);
+			}
+		}
+	}
+	if (ok && (r < 0 || last != 0)) {
+		// read error or the frame is truncated
+		fprintf(stderr, "%s: could not decompress\n", path);
+		ok = false;
+	}
+
+	free(out);
+	free(in);
+	ZSTD_freeDCtx(dctx);
+
+	// the content must never change, as it is shared between all opens
+	if (ok && fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+		perror("F_ADD_SEALS");
+		ok = false;
+	}
+	if (!ok) {
+		close(memfd);
+		errno = EIO;
+		return -1;
+	}
+	return memfd;
+#else
+	(void) src;
+	fprintf(stderr, "%s: copycat was built without zstd support\n", path);
+	errno = EOPNOTSUPP;
+	return -1;
+#endif
+}
+
+/*
+ * Opens a new file description for the memfd, so that the file offset is not shared
+ */
+static int reopen(int memfd, int flags) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", memfd);
+	return open(path, O_RDONLY | (flags & O_CLOEXEC));
+}
+
+/*
+ * Sums up the content sizes in the headers of all frames of the zstd compressed file src of size compressed_size
+ * Returns the size, or -1 if a frame does not store its content size.
+ */
+static off_t frame_content_size(int src, off_t compressed_size) {
+#ifdef HAVE_ZSTD
+	if (compressed_size == 0) {
+		return -1;
+	}
+	// only the pages holding frame and block headers are ever read
+	const char *data = mmap(NULL, compressed_size, PROT_READ, MAP_PRIVATE, src, 0);
+	if (data == MAP_FAILED) {
+		return -1;
+	}
+	off_t size = 0;
+	size_t pos = 0;
+	while (size >= 0 && pos < (size_t) compressed_size) {
+		const unsigned long long content = ZSTD_getFrameContentSize(data + pos, compressed_size - pos);
+		const size_t frame = ZSTD_findFrameCompressedSize(data + pos, compressed_size - pos);
+		if (content == ZSTD_CONTENTSIZE_UNKNOWN || content == ZSTD_CONTENTSIZE_ERROR || ZSTD_isError(frame)) {
+			size = -1;
+		} else {
+			size += content;
+			pos += frame;
+		}
+	}
+	munmap((void *) data, compressed_size);
+	return size;
+#else
+	(void) src;
+	(void) compressed_size;
+	return -1;
+#endif
+}
+
+void memfd_cache_set_budget(size_t bytes) {
+	budget = bytes;
+}
+
+int memfd_cache_open(int dirfd, const char *path, int flags) {
+	if (!initialized) {
+		memfd_cache_init();
+	}
+	if ((flags & O_ACCMODE) != O_RDONLY) {
+		errno = EROFS;
+		return -1;
+	}
+
+	int src = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+	if (src < 0) {
+		return -1;
+	}
+	struct stat st;
+	if (fstat(src, &st) < 0) {
+		close(src);
+		return -1;
+	}
+
+	// look for a cached copy, and remember the least recently used entry in case we need a new one
+	struct memfd_entry *lru = &entries[0];
+	for (size_t i = 0; i < MEMFD_CACHE_SIZE; ++i) {
+		struct memfd_entry *e = &entries[i];
+		if (memfd_entry_valid(e, path, &st)) {
+			close(src);
+			e->last_use = ++tick;
+			return reopen(e->memfd, flags);
+		}
+		if (e->memfd >= 0 && !strcmp(e->path, path)) {
+			// the compressed file has changed
+			memfd_cache_evict(e);
+		}
+		if (lru->memfd >= 0 && (e->memfd < 0 || e->last_use < lru->last_use)) {
+			lru = e;
+		}
+	}
+
+	int memfd = decompress(src, path);
+	close(src);
+	if (memfd < 0) {
+		return -1;
+	}
+	struct stat mst;
+	if (fstat(memfd, &mst) < 0) {
+		close(memfd);
+		return -1;
+	}
+	size_t size = mst.st_size;
+
+	if (size > budget || strlen(path) >= sizeof(lru->path)) {
+		// too large to be cached, serve it once
+		int fd = reopen(memfd, flags);
+		close(memfd);
+		return fd;
+	}
+
+	// make room for the new entry
+	if (lru->memfd >= 0) {
+		memfd_cache_evict(lru);
+	}
+	while (used + size > budget) {
+		struct memfd_entry *victim = NULL;
+		for (size_t i = 0; i < MEMFD_CACHE_SIZE; ++i) {
+			if (entries[i].memfd >= 0 && (victim == NULL || entries[i].last_use < victim->last_use)) {
+				victim = &entries[i];
+			}
+		}
+		memfd_cache_evict(victim);
+	}
+
+	lru->memfd = memfd;
+	lru->size = size;
+	lru->dev = st.st_dev;
+	lru->ino = st.st_ino;
+	lru->compressed_size = st.st_size;
+	lru->mtime = st.st_mtim;
+	lru->last_use = ++tick;
+	strcpy(lru->path, path);
+	used += size;
+	return reopen(memfd, flags);
+}
+
+off_t memfd_cache_size(int dirfd, const char *path) {
+	if (!initialized) {
+		memfd_cache_init();
+	}
+	int src = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+	if (src < 0) {
+		return -1;
+	}
+	struct stat st;
+	if (fstat(src, &st) < 0) {
+		close(src);
+		return -1;
+	}
+	for (size_t i = 0; i < MEMFD_CACHE_SIZE; ++i) {
+		if (memfd_entry_valid(&entries[i], path, &st)) {
+			close(src);
+			return entries[i].size;
+		}
+	}
+	off_t size = frame_content_size(src, st.st_size);
+	close(src);
+	if (size >= 0) {
+		return size;
+	}
+
+	// the frames do not tell, so decompress it
+	int fd = memfd_cache_open(dirfd, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	struct stat mst;
+	size = fstat(fd, &mst) < 0 ? -1 : mst.st_size;
+	close(fd);
+	return size;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <sys/types.h>
+
+// by default keep at most this many bytes of decompressed files in memory
+#define MEMFD_CACHE_DEFAULT_BUDGET (256UL << 20)
+
+/**
+ * Sets the upper limit of memory used for decompressed files
+ *
+ * Once the limit is reached, the least recently used files are evicted.
+ */
+void memfd_cache_set_budget(size_t bytes);
+
+/**
+ * Opens the zstd compressed file at path relative to dirfd and returns a new file descriptor to its decompressed content
+ *
+ * The decompressed content is kept in a sealed memfd, that is shared between all opens of the same file.
+ * Each returned descriptor has its own file offset though.
+ * Only read-only opens are supported, otherwise EROFS is returned.
+ * Returns -1 and sets errno on error.
+ */
+int memfd_cache_open(int dirfd, const char *path, int flags);
+
+/**
+ * Returns the size of the decompressed content of the zstd compressed file at path relative to dirfd
+ *
+ * The size is taken from a cached copy or from the frame headers, so that the file only needs to be decompressed if they do not store it.
+ * Returns -1 and sets errno on error.
+ */
+off_t memfd_cache_size(int dirfd, const char *path);
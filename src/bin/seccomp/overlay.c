@@ -0,0 +1,173 @@
+#include "overlay.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "copy.h"
+#include "util.h"
+
+// the per-run directories of all overlay rules of this supervisor
+static char *runs[MAX_OVERLAY_RUNS];
+static size_t runs_size = 0;
+static bool keep_runs = false;
+
+/*
+ * Creates the parent directories of dest in the overlay, if the parent directory of source exists
+ * Returns 0 on success or -1 with errno set.
+ */
+static int make_parent_dirs(const char *source, const char *dest) {
+	char dir[PATH_MAX];
+	snprintf(dir, sizeof(dir), "%s", source);
+	char *slash = strrchr(dir, '/');
+	struct stat st;
+	if (slash != NULL && slash != dir) {
+		*slash = '\0';
+		if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode)) {
+			// the original would not exist either
+			errno = ENOENT;
+			return -1;
+		}
+	}
+	snprintf(dir, sizeof(dir), "%s", dest);
+	slash = strrchr(dir, '/');
+	if (slash == NULL || slash == dir) {
+		return 0;
+	}
+	*slash = '\0';
+	return make_dirs(dir, 0755);
+}
+
+/*
+ * Copies the original file at source to dest
+ * Returns 0 on success or -1 with errno set.
+ */
+static int copy_up(const char *source, const char *dest, bool truncate) {
+	if (make_parent_dirs(source, dest) < 0) {
+		return -1;
+	}
+	int src = open(source, O_RDONLY | O_CLOEXEC);
+	if (src < 0) {
+		// nothing to copy, a newly created file only lives in the overlay
+		return errno == ENOENT ? 0 : -1;
+	}
+	struct stat st;
+	if (fstat(src, &st) < 0) {
+		close(src);
+		return -1;
+	}
+	if (!S_ISREG(st.st_mode)) {
+		// only regular files are copied
+		close(src);
+		errno = S_ISDIR(st.st_mode) ? EISDIR : EXDEV;
+		return -1;
+	}
+
+	char tmp[PATH_MAX + 8];
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", dest);
+	int dst = mkostemp(tmp, O_CLOEXEC);
+	if (dst < 0) {
+		close(src);
+		return -1;
+	}
+
+	const struct timespec times[2] = { st.st_atim, st.st_mtim };
+	int ret = 0;
+	if ((!truncate && copy_file(src, dst) < 0) || fchmod(dst, st.st_mode & 07777) < 0 || futimens(dst, times) < 0
+		|| rename(tmp, dest) < 0) {
+		int err = errno;
+		unlink(tmp);
+		errno = err;
+		ret = -1;
+	}
+	close(dst);
+	close(src);
+	return ret;
+}
+
+int overlay_copy_up(const char *source, const char *dest, bool truncate) {
+	if (source[0] != '/' || dest[0] != '/') {
+		// we only know where the original and the overlay are for absolute paths
+		errno = EXDEV;
+		return -1;
+	}
+	struct stat st;
+	if (lstat(dest, &st) == 0) {
+		// copied up already
+		return 0;
+	}
+	return errno == ENOENT ? copy_up(source, dest, truncate) : -1;
+}
+
+// Returns true if the original at path exists, or if that is unknown
+static bool original_exists(const char *path) {
+	struct stat st;
+	return lstat(path, &st) == 0 || errno != ENOENT;
+}
+
+int overlay_rename(const char *source, const char *dest, const char *target, const char *target_dest, unsigned int flags) {
+	if (source[0] != '/' || target[0] != '/' || original_exists(source) || original_exists(target)) {
+		errno = EROFS;
+		return -1;
+	}
+	if (make_parent_dirs(target, target_dest) < 0) {
+		return -1;
+	}
+	return renameat2(AT_FDCWD, dest, AT_FDCWD, target_dest, flags);
+}
+
+void overlay_set_keep(bool keep) {
+	keep_runs = keep;
+}
+
+int overlay_start_runs(size_t from) {
+	for (const struct rule_t *rule; (rule = rules_at(from)) != NULL; ++from) {
+		if (rule->mode != RULE_OVERLAY || rule->given_dest != NULL) {
+			// the rule has its directory already, or shares that of an inherited rule
+			continue;
+		}
+		if (runs_size >= MAX_OVERLAY_RUNS) {
+			errno = ENOSPC;
+			return -1;
+		}
+		char run[PATH_MAX];
+		int len = snprintf(run, sizeof(run), "%s/run-%d-XXXXXX", rule->dest, getpid());
+		if (len < 0 || (size_t) len >= sizeof(run)) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		if (make_dirs(rule->dest, 0755) < 0 || mkdtemp(run) == NULL || (runs[runs_size] = strdup(run)) == NULL) {
+			perror(rule->dest);
+			return -1;
+		}
+		runs_size++;
+		rule_set_dest(rule, run);
+	}
+	return 0;
+}
+
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *) {
+	if (remove(path) < 0) {
+		perror(path);
+	}
+	return 0;
+}
+
+void overlay_finish_runs() {
+	for (size_t i = 0; i < runs_size; ++i) {
+		if (keep_runs) {
+			fprintf(stderr, "copycat: kept overlay changes in %s\n", runs[i]);
+		} else {
+			// the contents are removed before their directory
+			nftw(runs[i], remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+		}
+		free(runs[i]);
+	}
+	runs_size = 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#define _GNU_SOURCE
+#include <stddef.h>
+
+#include "copycat.h"
+
+// the maximum number of overlay rules that get a per-run directory
+#define MAX_OVERLAY_RUNS 16
+
+/**
+ * Copies the original file at source to dest in the overlay, unless the copy exists already
+ *
+ * This is called before the first open of a file for writing, all later opens find the copy.
+ * The copy is created under a temporary name and renamed into place, so that it is never seen half-written.
+ * Nothing is copied if the original does not exist, so that the file is created in the overlay only,
+ * and only the permissions are copied if the open truncates anyway.
+ * Both source and dest need to be absolute paths.
+ * Returns 0 on success or -1 with errno set.
+ */
+int overlay_copy_up(const char *source, const char *dest, bool truncate);
+
+/**
+ * Renames source to target, whose files in the overlay are dest and target_dest, with flags like renameat2(2)
+ *
+ * Only files that exist in the overlay alone can be renamed, and only to names that have no original either,
+ * because otherwise the source directory would change. Both source and target need to be absolute paths.
+ * Returns 0 on success or -1 with errno set, which is EROFS if an original would be moved or replaced.
+ */
+int overlay_rename(const char *source, const char *dest, const char *target, const char *target_dest, unsigned int flags);
+
+/**
+ * Sets whether the per-run directories are kept on exit, instead of being removed
+ */
+void overlay_set_keep(bool keep);
+
+/**
+ * Gives every overlay rule from the position from onwards in the rule table its own directory for this run
+ *
+ * The directory is created as run-PID-XXXXXX below the destination of the rule, which then becomes the new destination,
+ * so that every run starts from the original content again. Rules whose destination was replaced already keep it.
+ * Returns 0 on success or -1 with errno set.
+ */
+int overlay_start_runs(size_t from);
+
+/**
+ * Removes all per-run directories including their content, unless they are kept
+ */
+void overlay_finish_runs();
@@ -0,0 +1,85 @@
+#include "overload.h"
+
+#include "stats.h"
+
+// the weight of a new sample in the moving averages, as a power of two
+#define EWMA_SHIFT 3
+
+// moving averages of the service time of any request, and of the queue depth times 2^EWMA_SHIFT
+static unsigned long long service_ns = 0;
+static unsigned long long depth_scaled = 0;
+
+static unsigned long long ewma(unsigned long long average, unsigned long long sample) {
+	if (average == 0) {
+		return sample;
+	}
+	return average - (average >> EWMA_SHIFT) + (sample >> EWMA_SHIFT);
+}
+
+static enum overload_action policy_action(const struct rule_t *rule) {
+	if (rule->overload == OVERLOAD_FAIL_CLOSED) {
+		stats.overload_fail_closed++;
+		return OVERLOAD_FAIL;
+	}
+	stats.overload_fail_open++;
+	return OVERLOAD_CONTINUE;
+}
+
+void overload_wakeup(size_t depth) {
+	depth_scaled = ewma(depth_scaled, depth << EWMA_SHIFT);
+	if (depth > stats.max_queue_depth) {
+		stats.max_queue_depth = depth;
+	}
+}
+
+enum overload_action overload_check(const struct rule_t *rule, unsigned long long received_ns, bool cancellable, unsigned long long *remaining_ns) {
+	*remaining_ns = 0;
+	if (!rule->budget_ns) {
+		return OVERLOAD_SERVE;
+	}
+	struct rule_load *load = rule_load(rule);
+	if (load == NULL) {
+		return OVERLOAD_SERVE;
+	}
+
+	// the request waits for everything that is queued in front of it, unless it has been waiting for longer already
+	const unsigned long long now = stats_now_ns();
+	const unsigned long long waited = now - received_ns;
+	const unsigned long long depth = depth_scaled >> EWMA_SHIFT;
+	const unsigned long long queued = depth > 1 ? (depth - 1) * service_ns : 0;
+	const unsigned long long predicted = (waited > queued ? waited : queued) + load->service_ns;
+	if (predicted > rule->budget_ns) {
+		if (now - load->last_probe_ns >= OVERLOAD_PROBE_INTERVAL_NS) {
+			load->last_probe_ns = now;
+			if (cancellable) {
+				// let a single request through to measure again, with the full budget so that it can actually complete
+				stats.overload_probes++;
+				*remaining_ns = rule->budget_ns;
+				return OVERLOAD_SERVE;
+			}
+			// nothing would stop this request if the rule has not recovered, so forget about the past instead of measuring again
+			load->service_ns >>= 1;
+		}
+		if (queued > waited) {
+			stats.overload_queued++;
+		}
+		return policy_action(rule);
+	}
+	*remaining_ns = rule->budget_ns - waited;
+	return OVERLOAD_SERVE;
+}
+
+void overload_served(const struct rule_t *rule, unsigned long long service) {
+	service_ns = ewma(service_ns, service);
+	struct rule_load *load = rule_load(rule);
+	if (load != NULL) {
+		load->service_ns = ewma(load->service_ns, service);
+	}
+}
+
+enum overload_action overload_expired(const struct rule_t *rule) {
+	stats.overload_expired++;
+	// the next requests should not wait for this long again
+	overload_served(rule, rule->budget_ns);
+	return policy_action(rule);
+}
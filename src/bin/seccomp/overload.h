@@ -0,0 +1,44 @@
+#pragma once
+
+#define _GNU_SOURCE
+#include <stddef.h>
+
+#include "copycat.h"
+
+// how often a request is let through, even though the rule is over its budget, to find out whether it has recovered,
+// or how often the service time of a rule is halved, if its requests cannot be cancelled
+#define OVERLOAD_PROBE_INTERVAL_NS 100000000ULL
+
+enum overload_action {
+	// handle the request as usual
+	OVERLOAD_SERVE,
+	// let the task continue with the original system call
+	OVERLOAD_CONTINUE,
+	// fail the system call with EAGAIN
+	OVERLOAD_FAIL,
+};
+
+/**
+ * Records that the supervisor found depth notifications pending when it woke up
+ */
+void overload_wakeup(size_t depth);
+
+/**
+ * Decides whether a request of rule can be served within the latency budget of the rule
+ *
+ * The latency of the request is predicted from the time since it was received at received_ns,
+ * the queue depth and the recent service times of the supervisor and of the rule.
+ * Only requests that are cancellable, because they are cancelled once they run out of their budget, are let through as probes.
+ * If it is served, remaining_ns is set to the time that is left of the budget, or 0 if the rule has no budget.
+ */
+enum overload_action overload_check(const struct rule_t *rule, unsigned long long received_ns, bool cancellable, unsigned long long *remaining_ns);
+
+/**
+ * Records that serving a request of rule took service_ns
+ */
+void overload_served(const struct rule_t *rule, unsigned long long service_ns);
+
+/**
+ * Returns what to do with a request of rule that was started, but ran out of its budget before it completed
+ */
+enum overload_action overload_expired(const struct rule_t *rule);
@@ -0,0 +1,84 @@
+#include "resolver.h"
+
+#include <dlfcn.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "copycat_resolver.h"
+#include "stats.h"
+
+#define RESOLVER_CACHE_SIZE 256
+
+struct resolver_entry {
+	// the memoised path, or NULL if the entry is unused
+	char *path;
+	// the destination, or NULL if the path is not redirected
+	char *dest;
+};
+
+static int (*resolve)(const char *path, char *buf, size_t len) = NULL;
+static struct resolver_entry cache[RESOLVER_CACHE_SIZE];
+static char dest_buffer[PATH_MAX];
+
+int resolver_load(const char *path) {
+	void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (handle == NULL) {
+		fprintf(stderr, "%s\n", dlerror());
+		return -1;
+	}
+	resolve = (int (*)(const char *, char *, size_t)) dlsym(handle, "copycat_resolve");
+	if (resolve == NULL) {
+		fprintf(stderr, "%s: missing copycat_resolve\n", path);
+		dlclose(handle);
+		return -1;
+	}
+	return 0;
+}
+
+bool resolver_loaded() {
+	return resolve != NULL;
+}
+
+static size_t hash(const char *s) {
+	// FNV-1a
+	size_t h = 14695981039346656037ULL;
+	for (; *s; ++s) {
+		h = (h ^ (unsigned char) *s) * 1099511628211ULL;
+	}
+	return h;
+}
+
+const char *resolver_resolve(const char *path) {
+	if (resolve == NULL) {
+		return NULL;
+	}
+
+	struct resolver_entry *e = &cache[hash(path) % RESOLVER_CACHE_SIZE];
+	if (e->path != NULL && !strcmp(e->path, path)) {
+		stats.resolver_cache_hits++;
+		return e->dest;
+	}
+
+	const unsigned long long start = stats_now_ns();
+	int ret = resolve(path, dest_buffer, sizeof(dest_buffer));
+	const unsigned long long elapsed = stats_now_ns() - start;
+	stats.resolver_calls++;
+	stats.resolver_ns_total += elapsed;
+	if (elapsed > stats.resolver_ns_max) {
+		stats.resolver_ns_max = elapsed;
+	}
+
+	const bool match = ret > 0 && (ret & COPYCAT_RESOLVE_MATCH) && *dest_buffer;
+	// never trust the plugin to terminate the string
+	dest_buffer[sizeof(dest_buffer) - 1] = '\0';
+	if (ret > 0 && (ret & COPYCAT_RESOLVE_CACHEABLE)) {
+		// replace whatever was memoised in this slot before
+		free(e->path);
+		free(e->dest);
+		e->path = strdup(path);
+		e->dest = match ? strdup(dest_buffer) : NULL;
+	}
+	return match ? dest_buffer : NULL;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#define _GNU_SOURCE
+
+/**
+ * Loads the resolver plugin at path, see copycat_resolver.h
+ *
+ * Returns 0 on success or -1 on error.
+ */
+int resolver_load(const char *path);
+
+/**
+ * Returns whether a resolver plugin is loaded
+ */
+bool resolver_loaded();
+
+/**
+ * Asks the resolver plugin for the destination of path
+ *
+ * Cacheable results are memoised in a bounded cache, so the plugin is only asked once per path.
+ * Returns the destination, which stays valid until the next call, or NULL if path is not redirected.
+ */
+const char *resolver_resolve(const char *path);
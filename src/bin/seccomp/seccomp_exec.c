@@ -2,6 +2,7 @@
 
 #include <linux/openat2.h>
 #include <linux/limits.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <sys/prctl.h>
@@ -10,15 +11,41 @@
 #include <sys/utsname.h>
 #include <sys/wait.h>
 
-#include "syscalls/openat2.h"
-
-// list of all syscalls to trap
-static const int scalls[] = {
-	__NR_open,
-	__NR_openat,
-	__NR_openat2,
+#include "control.h"
+#include "fd_cache.h"
+#include "overlay.h"
+#include "overload.h"
+#include "resolver.h"
+#include "stats.h"
+#include "syscall_handlers.h"
+#include "task_cache.h"
+#include "uring.h"
+
+// the maximum number of nested copycat instances whose rules are applied by this supervisor at the same time
+#define MAX_SUBTREES 16
+
+// a nested copycat instance, whose rules apply to its process subtree
+struct subtree_t {
+	pid_t pid;
+	// becomes readable once the process has exited
+	int pidfd;
 };
 
+static struct subtree_t subtrees[MAX_SUBTREES];
+static size_t subtrees_size = 0;
+
+// how long a batch waits for opens after the largest remaining latency budget, for their cancellation to complete
+#define CANCEL_GRACE_NS 1000000ULL
+// the maximum number of notifications that are handled together in batch mode
+#define MAX_BATCH_SIZE 32
+
+static bool batch_enabled = false;
+// the command line options that only our own supervisor applies, which are ignored if another one takes over our rules
+static const char *supervisor_options = "";
+// whether batches submit their opens through io_uring, and whether setting it up failed already
+static bool uring_enabled = false;
+static bool uring_failed = false;
+
 void handle_child_exit(int) {
 	// This hacky workaround is only needed for old Linux kernel versions. With latest Linux,
 	// SECCOMP_IOCTL_NOTIF_RECV will return to the caller properly once the supervised child exits.
@@ -28,14 +55,63 @@ void handle_child_exit(int) {
 	exit(0);
 }
 
+// Returns all kinds of access that the filter needs to trap
+static enum rule_access filter_access() {
+	// a resolver plugin may redirect any path, so it needs to see all kinds of access
+	return resolver_loaded() ? ACCESS_ANY : rules_access();
+}
+
+// Returns the bitmask over syscall_descs of all syscalls that the filter needs to trap for the current rules
+static uint64_t filter_descs(enum rule_access access) {
+	uint64_t trapped = 0;
+	for (size_t i = 0; i < syscall_descs_size; ++i) {
+		const struct syscall_desc *desc = &syscall_descs[i];
+		if ((desc->access & access) && (desc->needed == NULL || desc->needed())) {
+			trapped |= (uint64_t) 1 << i;
+		}
+	}
+	return trapped;
+}
+
 int seccomp_child(const char *file, char *const argv[], struct seccomp_state *state) {
 	// agree to not gain any new privs, see man 2 seccomp section SECCOMP_SET_MODE_FILTER
 	prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
 
-	state->listener = user_trap_syscalls(scalls, ARRAY_SIZE(scalls), SECCOMP_FILTER_FLAG_NEW_LISTENER);
+	// trap all syscalls that we have a handler for
+	struct syscall_trap traps[syscall_descs_size];
+	size_t traps_size = 0;
+	const enum rule_access access = state->access;
+	for (size_t i = 0; i < syscall_descs_size; ++i) {
+		const struct syscall_desc *desc = &syscall_descs[i];
+		struct syscall_trap *t = &traps[traps_size];
+		t->nr = desc->nr;
+		t->condition = TRAP_ALWAYS;
+		if (!(state->trapped & ((uint64_t) 1 << i))) {
+			// no rule could ever change this syscall
+			continue;
+		}
+		if (desc->flags_arg >= 0 && access != ACCESS_ANY) {
+			// all rules are scoped to either read or write access, so let the kernel decide by the open flags
+			t->condition = access == ACCESS_READ ? TRAP_IF_NONE_SET : TRAP_IF_ANY_SET;
+			t->arg = desc->flags_arg;
+			t->mask = OPEN_WRITE_FLAGS;
+		} else if (desc->at_flags_arg >= 0) {
+			// fstat() and friends operate on the file descriptor itself, which is never redirected
+			t->condition = TRAP_IF_NONE_SET;
+			t->arg = desc->at_flags_arg;
+			t->mask = AT_EMPTY_PATH;
+		}
+		traps_size++;
+	}
+	state->listener = user_trap_syscalls(traps, traps_size, SECCOMP_FILTER_FLAG_NEW_LISTENER);
 	// check if syscall trap setup was successful
 	if (state->listener < 0) {
+		const int err = errno;
 		perror("user_trap_syscalls");
+		if (err == EBUSY) {
+			// the kernel only allows a single listener in the filter chain of a task
+			fprintf(stderr, "Already supervised by a seccomp listener that did not take over our rules\n");
+		}
 		return -1;
 	}
 
@@ -53,6 +129,70 @@ int seccomp_child(const char *file, char *const argv[], struct seccomp_state *st
 	return res;
 }
 
+// Enables batch mode and io_uring, if the options or the rules need them
+static void setup_batch() {
+	// latency budgets depend on the queue depth, which is only known when draining all pending notifications
+	batch_enabled = batch_enabled || rules_have_budgets();
+	if (!batch_enabled || uring_enabled || uring_failed) {
+		return;
+	}
+	// every open may need a linked timeout entry
+	uring_enabled = uring_init(2 * MAX_BATCH_SIZE) == 0;
+	if (!uring_enabled) {
+		uring_failed = true;
+		perror("io_uring");
+		if (rules_have_budgets()) {
+			fprintf(stderr, "WARNING: io_uring is not available, latency budgets are only enforced before opening...\n");
+		} else {
+			fprintf(stderr, "WARNING: io_uring is not available, handling notifications one by one...\n");
+			batch_enabled = false;
+		}
+	}
+}
+
+// Forgets the rules of the nested instance at index i in subtrees, because its process has exited
+static void remove_subtree(size_t i) {
+	rules_remove_subtree(subtrees[i].pid);
+	close(subtrees[i].pidfd);
+	subtrees[i] = subtrees[--subtrees_size];
+	task_cache_clear();
+}
+
+// Takes over the rules of a nested copycat instance, so that it does not need to stack another supervisor
+static void handle_control(struct seccomp_state *state) {
+	static char rules[MAX_CONTROL_MSG_SIZE];
+	pid_t pid;
+	int reply = control_recv(state->control, &pid, rules, sizeof(rules));
+	if (reply < 0) {
+		return;
+	}
+
+	bool accepted = false;
+	int pidfd = subtrees_size < MAX_SUBTREES ? pidfd_open(pid, 0) : -1;
+	if (pidfd >= 0) {
+		const struct rules_mark_t mark = rules_mark();
+		accepted = parse_subtree_rules(rules, pid);
+		const enum rule_access access = filter_access();
+		if (accepted && ((access & ~state->access) || (filter_descs(access) & ~state->trapped))) {
+			// the new rules need syscalls that our filter does not trap, so the nested instance has to install its own
+			rules_rollback(mark);
+			accepted = false;
+		} else if (accepted && overlay_start_runs(mark.rules) < 0) {
+			rules_rollback(mark);
+			accepted = false;
+		}
+	}
+	if (accepted) {
+		subtrees[subtrees_size++] = (struct subtree_t) { .pid = pid, .pidfd = pidfd };
+		// the rules that apply to each task have changed, and they may have latency budgets
+		task_cache_clear();
+		setup_batch();
+	} else if (pidfd >= 0) {
+		close(pidfd);
+	}
+	control_reply(reply, accepted);
+}
+
 int seccomp_parent(struct seccomp_state *state) {
 	int exit_code = EXIT_FAILURE;
 
@@ -62,13 +202,6 @@ int seccomp_parent(struct seccomp_state *state) {
 		return -1;
 	}
 
-	// first get a pidfd
-	int pidfd = pidfd_open(state->task_pid, 0);
-	if (pidfd < 0) {
-		perror("pidfd_open");
-		return -1;
-	}
-
 	// check for old Linux kernel version
 	struct utsname uts;
 	if (!uname(&uts)) {
@@ -101,8 +234,40 @@ int seccomp_parent(struct seccomp_state *state) {
 	req = malloc(sizes.seccomp_notif);
 	resp = malloc(sizes.seccomp_notif_resp);
 	memset(resp, 0, sizes.seccomp_notif_resp);
+	setup_batch();
 
+	struct pollfd fds[2 + MAX_SUBTREES] = {
+		{ .fd = state->listener, .events = POLLIN },
+		{ .fd = state->control, .events = POLLIN },
+	};
 	while (true) {
+		// wait for notifications, nested copycat instances, and the exit of their process subtrees
+		for (size_t i = 0; i < subtrees_size; ++i) {
+			fds[2 + i] = (struct pollfd) { .fd = subtrees[i].pidfd, .events = POLLIN };
+		}
+		if (poll(fds, 2 + subtrees_size, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("poll");
+			break;
+		}
+		// forget exited subtrees before accepting new ones, as this reorders the subtrees
+		for (size_t i = subtrees_size; i > 0; --i) {
+			if (fds[1 + i].revents) {
+				remove_subtree(i - 1);
+			}
+		}
+		if (fds[1].revents & POLLIN) {
+			handle_control(state);
+		} else if (fds[1].revents) {
+			// all supervised processes are gone
+			fds[1].fd = -1;
+		}
+		if (!fds[0].revents) {
+			continue;
+		}
+
 		memset(req, 0, sizes.seccomp_notif);
 		if (ioctl(state->listener, SECCOMP_IOCTL_NOTIF_RECV, req)) {
 			if (errno == ENOENT) {
@@ -120,30 +285,78 @@ int seccomp_parent(struct seccomp_state *state) {
 			}
 			break;
 		}
-		if (handle_req(req, resp, state->listener, pidfd) < 0) {
+		if ((batch_enabled ? handle_batch(req, resp, state->listener, sizes.seccomp_notif) : handle_req(req, resp, state->listener)) < 0) {
 			break;
 		}
 	}
 
 	// cleanup
+	while (subtrees_size) {
+		remove_subtree(subtrees_size - 1);
+	}
+	if (state->control >= 0) {
+		close(state->control);
+	}
+	if (uring_enabled) {
+		uring_exit();
+	}
+	overlay_finish_runs();
+	if (stats.enabled) {
+		stats_print(stderr);
+	}
 	free(resp);
 	free(req);
-	close(pidfd);
 	close(state->listener);
 	exit(exit_code);
 }
 
+void seccomp_set_batch(bool enabled) {
+	batch_enabled = enabled;
+}
+
+void seccomp_set_supervisor_options(const char *options) {
+	supervisor_options = options;
+}
+
 int seccomp_exec(const char *file, char *const argv[]) {
+	// if we are supervised by copycat already, let that supervisor apply our rules instead of stacking another one
+	if (!resolver_loaded() && control_join(rules_text())) {
+		if (*supervisor_options) {
+			fprintf(stderr, "copycat: the supervisor of a parent process took over the rules, ignoring %s\n", supervisor_options);
+		}
+		execvp(file, argv);
+		perror(file);
+		return -1;
+	}
+
+	// every run starts from the original content of overlays
+	if (overlay_start_runs(0) < 0) {
+		return -1;
+	}
+
 	struct seccomp_state state;
 	if (socketpair(PF_LOCAL, SOCK_SEQPACKET, 0, state.sk_pair) < 0) {
 		perror("socketpair");
 		return -1;
 	}
+	int control_child = -1;
+	state.control = control_open(&control_child);
+	state.access = filter_access();
+	state.trapped = filter_descs(state.access);
 
 	state.task_pid = fork();
 	if (state.task_pid) {
+		if (control_child >= 0) {
+			close(control_child);
+		}
+		// only keep our end, so that we notice if the child dies before sending the listener
+		close(state.sk_pair[1]);
 		return seccomp_parent(&state);
 	} else {
+		if (state.control >= 0) {
+			close(state.control);
+		}
+		close(state.sk_pair[0]);
 		return seccomp_child(file, argv, &state);
 	}
 }
@@ -162,35 +375,205 @@ int pidfd_getfd(int pidfd, int targetfd, unsigned int flags) {
 	return syscall(__NR_pidfd_getfd, pidfd, targetfd, flags);
 }
 
-int handle_req(struct seccomp_notif *req,
-		      struct seccomp_notif_resp *resp, int listener, int pidfd)
+int task_getfd(pid_t tid, int targetfd) {
+	// the request may come from any descendant of the initial child, so we need a pidfd for exactly this task
+	int pidfd = pidfd_open(tid, 0);
+	if (pidfd < 0 && (errno == EINVAL || errno == ENOENT)) {
+		// tid is not a thread group leader, which fails with EINVAL before Linux 6.9 and ENOENT after,
+		// but threads share their descriptors with the leader, which we can open on any kernel
+		char path[64], status[4096];
+		snprintf(path, sizeof(path), "/proc/%d/status", tid);
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			return -1;
+		}
+		ssize_t len = read(fd, status, sizeof(status) - 1);
+		close(fd);
+		status[len < 0 ? 0 : len] = '\0';
+		const char *tgid = strstr(status, "\nTgid:");
+		if (tgid == NULL) {
+			errno = ESRCH;
+			return -1;
+		}
+		pidfd = pidfd_open(strtol(tgid + strlen("\nTgid:"), NULL, 10), 0);
+	}
+	if (pidfd < 0) {
+		return -1;
+	}
+	int fd = pidfd_getfd(pidfd, targetfd, 0);
+	int err = errno;
+	close(pidfd);
+	errno = err;
+	return fd;
+}
+
+int continue_req(struct seccomp_notif_resp *resp, int listener) {
+	stats.continued++;
+	resp->flags |= SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+	resp->error = 0;
+	resp->val = 0;
+	if (ioctl(listener, SECCOMP_IOCTL_NOTIF_SEND, resp) < 0 && errno != ENOENT) {
+		perror("ioctl send");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Fails the request with error, which is -errno
+ * Returns 0 on success or -1 on error.
+ */
+static int fail_req(struct seccomp_notif_resp *resp, int listener, int error)
 {
+	resp->flags = 0;
+	resp->error = error;
+	resp->val = 0;
+	if (ioctl(listener, SECCOMP_IOCTL_NOTIF_SEND, resp) < 0 && errno != ENOENT) {
+		perror("ioctl send");
+		return -1;
+	}
+	return 0;
+}
+
+// a request while it is being handled, possibly together with others in a batch
+struct pending_req {
+	struct seccomp_notif *req;
+	const struct syscall_desc *desc;
+	struct req_ctx ctx;
+	// the opened /proc/pid/mem of the task, or -1
+	int mem;
+	char pathname[PATH_MAX];
+	char abspath[PATH_MAX];
+	char proxy_pathname[PATH_MAX];
+	char pathname2[PATH_MAX];
+	// whether the handler was submitted through io_uring and has not completed yet
+	bool queued;
+	// when the notification was received, and when its handler started
+	unsigned long long received_ns;
+	unsigned long long started_ns;
+	// the time that is left of the latency budget of the rule, or 0 if there is none
+	unsigned long long remaining_ns;
+};
+
+// stands in for the rule of destinations from the resolver plugin
+static const struct rule_t resolved_rule = {
+	.mode = RULE_REDIRECT,
+	.access = ACCESS_ANY,
+};
+
+/*
+ * Finds the rule that pathname of the request p->req matches
+ * Relative paths are resolved against dirfd, and paths that no rule matches are handed to the resolver plugin.
+ */
+static void match_pathname(struct pending_req *p, int dirfd, char *pathname, enum rule_access access)
+{
+	struct req_ctx *ctx = &p->ctx;
+	ctx->pathname = pathname;
+	ctx->rule = find_match(&ctx->proxy_pathname, pathname, access, ctx->index);
+	if (ctx->rule == NULL && pathname[0] != '/' && pathname[0] != '\0') {
+		// Relative paths are interpreted relative to dirfd or the current working directory of the task.
+		// Resolve them to an absolute path, so that they can match absolute rules, too.
+		const char *dir = fd_cache_lookup(p->req->pid, dirfd);
+		if (dir != NULL && join_path(p->abspath, sizeof(p->abspath), dir, pathname)) {
+			ctx->rule = find_match(&ctx->proxy_pathname, p->abspath, access, ctx->index);
+			ctx->pathname = p->abspath;
+		}
+	}
+	if (ctx->rule == NULL && !p->desc->overlay_only) {
+		// no static rule matched, so ask the resolver plugin, if there is one
+		const char *dest = resolver_resolve(ctx->pathname);
+		if (dest != NULL) {
+			ctx->rule = &resolved_rule;
+			ctx->proxy_pathname = dest;
+		}
+	}
+	if (ctx->rule != NULL && ctx->pathname == p->abspath && !fd_cache_current(p->req->pid, dirfd)) {
+		// the cached path of dirfd missed a rename of one of its parents, so match the current one instead
+		match_pathname(p, dirfd, pathname, access);
+		return;
+	}
+	if (ctx->rule != NULL && p->desc->overlay_only && ctx->rule->mode != RULE_OVERLAY) {
+		ctx->rule = NULL;
+	}
+}
+
+/*
+ * Reads the path at addr in the memory of the task of the request p->req and finds the rule that it matches, see match_pathname()
+ * Returns 0 on success, even if no rule matched, or -EFAULT if the path cannot be read, like the kernel would.
+ */
+static int match_path(struct pending_req *p, int dirfd, unsigned long long addr, enum rule_access access)
+{
+	char *pathname = p->pathname;
+	if (pread(p->mem, pathname, sizeof(p->pathname), addr) < 0) {
+		// a bad pointer only fails this syscall, not the task
+		return -EFAULT;
+	}
+	pathname[sizeof(p->pathname) - 1] = '\0';
+	match_pathname(p, dirfd, pathname, access);
+	return 0;
+}
+
+/*
+ * Reads the arguments of the request p->req and finds the matching rule
+ * Returns 1 if the handler needs to run, 0 if the request was answered already, or -1 on error.
+ * In any case, release_req() needs to be called afterwards.
+ */
+static int resolve_req(struct pending_req *p, struct seccomp_notif_resp *resp, int listener)
+{
+	struct seccomp_notif *req = p->req;
+	struct req_ctx *ctx = &p->ctx;
 	char path[PATH_MAX];
+	char *pathname = p->pathname;
 	int ret = -1, mem;
 
-	int dirfd = -1, proxy_dirfd = -1;
-	char pathname[PATH_MAX];
-	const char *proxy_pathname = NULL;
-	int flags;
-	mode_t mode;
-	struct open_how how;
+	int dirfd = AT_FDCWD;
+	*ctx = (struct req_ctx) {
+		.req = req,
+		.listener = listener,
+		.proxy_dirfd = AT_FDCWD,
+	};
+	p->mem = -1;
+	p->remaining_ns = 0;
 
-	int nr = req->data.nr;
+	const struct syscall_desc *desc = syscall_desc_find(req->data.nr);
+	p->desc = desc;
+	stats.requests++;
 
 	resp->id = req->id;
 	resp->error = -EPERM;
 	resp->val = 0;
 	resp->flags = 0;
 
+	if (desc == NULL) {
+		// the filter only traps syscalls that we know about
+		fprintf(stderr, "unexpected syscall %d\n", req->data.nr);
+		if (ioctl(listener, SECCOMP_IOCTL_NOTIF_SEND, resp) < 0 && errno != ENOENT) {
+			perror("ioctl send");
+		}
+		return 0;
+	}
+
+	if (desc->observe != NULL) {
+		desc->observe(req);
+		return continue_req(resp, listener);
+	}
+
+	// only look at the rules that apply to this task
+	ctx->index = task_cache_rules(req->pid);
+
 	/*
 	 * Ok, let's read the task's memory to see what they wanted to open
 	 */
 	snprintf(path, sizeof(path), "/proc/%d/mem", req->pid);
 	mem = open(path, O_RDONLY);
 	if (mem < 0) {
+		// most likely the task is gone, which makes answering it a no-op, so this only affects this request
+		const int err = errno;
 		perror("open mem");
-		return -1;
+		return fail_req(resp, listener, -err);
 	}
+	p->mem = mem;
+	ctx->mem = mem;
 
 	/*
 	 * Now we avoid a TOCTOU: we referred to a pid by its pid, but since
@@ -204,7 +587,9 @@ int handle_req(struct seccomp_notif *req,
 	 * decisions.
 	 */
 	if (!cookie_valid(listener, req)) {
+		// the task is gone, so there is no one to answer, but all other tasks still need us
 		fprintf(stderr, "task died before we could map its memory\n");
+		ret = 0;
 		goto out;
 	}
 
@@ -213,103 +598,326 @@ int handle_req(struct seccomp_notif *req,
 	 * that to avoid another TOCTOU, we should read all of the pointer args
 	 * before we decide to allow the syscall.
 	 */
-
-	// the arguments are shifted one to the right for all syscalls but open
-	const int argoffset = nr != __NR_open;
-	ret = pread(mem, pathname, sizeof(pathname), req->data.args[argoffset]);
-	if (ret < 0) {
-		perror("pread");
-		goto out;
+	if (desc->dirfd_arg >= 0) {
+		dirfd = ls_int(req->data.args[desc->dirfd_arg]);
 	}
-	// Get the redirected file path
-	if (!find_match(&proxy_pathname, pathname)) {
-		// continue the syscall normally if there is no match
-		resp->flags |= SECCOMP_USER_NOTIF_FLAG_CONTINUE;
-		resp->error = 0;
-		resp->val = 0;
-		if (ioctl(listener, SECCOMP_IOCTL_NOTIF_SEND, resp) < 0 && errno != ENOENT) {
-			ret = -1;
-			perror("ioctl send");
+
+	// rules may only apply to some kinds of access, so find out what the task wants to do
+	enum rule_access access = desc->access;
+	if (desc->flags_arg >= 0) {
+		access = open_flags_access(ls_int(req->data.args[desc->flags_arg]));
+	} else if (desc->how_arg >= 0) {
+		// read the special how struct
+		if (pread(mem, &ctx->how, sizeof(ctx->how), req->data.args[desc->how_arg]) < 0) {
+			ret = fail_req(resp, listener, -EFAULT);
+			goto out;
 		}
-		goto out;
+		access = open_flags_access(ctx->how.flags);
 	}
 
-	if (nr == __NR_openat2) {
-		// read the special how struct
-		ret = pread(mem, &how, sizeof(how), req->data.args[2]);
-		if (ret < 0) {
-			perror("pread");
+	// the syscall changes a second path, which the handler needs as well, and which may match if the first one does not
+	const struct rule_t *rule2 = NULL;
+	if (desc->path2_arg >= 0) {
+		const int dirfd2 = desc->dirfd2_arg >= 0 ? ls_int(req->data.args[desc->dirfd2_arg]) : AT_FDCWD;
+		if ((ret = match_path(p, dirfd2, req->data.args[desc->path2_arg], access)) < 0) {
+			ret = fail_req(resp, listener, ret);
 			goto out;
 		}
+		snprintf(p->pathname2, sizeof(p->pathname2), "%s", ctx->pathname);
+		ctx->pathname2 = p->pathname2;
+		rule2 = ctx->rule;
+	}
+
+	// Get the redirected file path
+	if (desc->path_arg < 0) {
+		// the syscall operates on the directory referred to by dirfd, so match its path instead
+		const char *dir = fd_cache_lookup(req->pid, dirfd);
+		ctx->rule = dir != NULL ? find_union(&ctx->proxy_pathname, dir, ctx->index) : NULL;
+		if (ctx->rule != NULL && !fd_cache_current(req->pid, dirfd)) {
+			// the cached path missed a rename of one of its parents, so match the current one instead
+			dir = fd_cache_lookup(req->pid, dirfd);
+			ctx->rule = dir != NULL ? find_union(&ctx->proxy_pathname, dir, ctx->index) : NULL;
+		}
+		snprintf(pathname, sizeof(p->pathname), "%s", dir != NULL ? dir : "");
+		ctx->pathname = pathname;
+	} else if ((ret = match_path(p, dirfd, req->data.args[desc->path_arg], access)) < 0) {
+		ret = fail_req(resp, listener, ret);
+		goto out;
+	}
+	if (ctx->rule == NULL) {
+		ctx->rule = rule2;
+	}
+	if (ctx->rule == NULL) {
+		// continue the syscall normally if there is no match
+		ret = continue_req(resp, listener);
+		goto out;
 	}
 
-	if (nr != __NR_open) {
-		dirfd = ls_int(req->data.args[0]);
+	// shed the request early if it would not make its latency budget anyway,
+	// where only plain opens submitted through io_uring can be cancelled once they run out of it
+	struct open_how how;
+	bool openat2;
+	const bool cancellable = uring_enabled && redirect_open_args(ctx, &how, &openat2);
+	switch (overload_check(ctx->rule, p->received_ns, cancellable, &p->remaining_ns)) {
+	case OVERLOAD_SERVE:
+		break;
+	case OVERLOAD_CONTINUE:
+		ret = continue_req(resp, listener);
+		goto out;
+	case OVERLOAD_FAIL:
+		ret = fail_req(resp, listener, -EAGAIN);
+		goto out;
 	}
-	// Pass-through dirfd from supervised process, in case it is needed for openat.
-	// This is the case if:
-	// - pathname is not absolute
-	// - dirfd is NOT AT_FDCWD
+
+	// Pass-through dirfd from supervised process, in case it is needed for the redirected path.
+	// This is only the case if the redirected path is not absolute,
+	// in particular paths that only matched after resolving them never need the task's dirfd.
 	//
 	// For more info see man openat(2)
-	if (dirfd >= 0 && pathname[0] != '/') {
-		// duplicate the file descriptor
-		ret = pidfd_getfd(pidfd, dirfd, 0);
-		if (ret < 0) {
-			perror("pidfd_getfd");
-			goto out;
+	if (ctx->proxy_pathname[0] != '/') {
+		if (dirfd == AT_FDCWD) {
+			// relative to the current working directory of the task
+			snprintf(path, sizeof(path), "/proc/%d/cwd", req->pid);
+			ret = open(path, O_PATH | O_DIRECTORY);
+			if (ret < 0) {
+				const int err = errno;
+				perror("open cwd");
+				ret = fail_req(resp, listener, -err);
+				goto out;
+			}
+			ctx->proxy_dirfd = ret;
 		} else {
-			printf("Duplicating relative openat dirfd %d...", dirfd);
-			proxy_dirfd = ret;
+			// duplicate the file descriptor
+			ret = task_getfd(req->pid, dirfd);
+			if (ret < 0) {
+				// the task is gone, or dirfd is not a valid descriptor of the task, which fails the syscall with EBADF anyway
+				const int err = errno;
+				perror("pidfd_getfd");
+				ret = fail_req(resp, listener, -err);
+				goto out;
+			} else {
+				printf("Duplicating relative openat dirfd %d...", dirfd);
+				ctx->proxy_dirfd = ret;
+			}
 		}
 	}
 
 	if (!cookie_valid(listener, req)) {
 		perror("post-read TOCTOU");
+		ret = 0;
 		goto out;
 	}
 
-	flags = ls_int(req->data.args[argoffset + 1]);
-	mode = (mode_t) ls_int(req->data.args[argoffset + 2]);
+	// find_match() returns a buffer that is shared by all requests
+	snprintf(p->proxy_pathname, sizeof(p->proxy_pathname), "%s", ctx->proxy_pathname);
+	ctx->proxy_pathname = p->proxy_pathname;
+	ret = 1;
+out:
+	return ret;
+}
 
-	// Make the final system call
-	// This will resolve to our overloaded syscall
-	if (nr == __NR_open) {
-		ret = open(proxy_pathname, flags, mode);
-	} else if (nr == __NR_openat) {
-		ret = openat(proxy_dirfd, proxy_pathname, flags, mode);
-	} else if (nr == __NR_openat2) {
-		ret = openat2(proxy_dirfd, proxy_pathname, &how, sizeof(struct open_how));
-	}
+/*
+ * Answers the request p->req with the result of its handler
+ * Returns 0 on success or -1 on error.
+ */
+static int complete_req(struct pending_req *p, struct seccomp_notif_resp *resp, int listener, long result)
+{
+	struct seccomp_notif *req = p->req;
+	int ret = -1;
+	stats.redirected++;
 
-	if (ret == -1) {
-		ret = 0;
-		// task got a signal and restarted the syscall
+	resp->id = req->id;
+	resp->val = 0;
+	resp->flags = 0;
+	if (result < 0 || !p->desc->returns_fd) {
+		// hand the result of the redirected call over to the task, it never executes the syscall itself
+		if (result < 0) {
+			resp->error = (int) result;
+		} else {
+			resp->error = 0;
+			resp->val = result;
+		}
 		if (ioctl(listener, SECCOMP_IOCTL_NOTIF_SEND, resp) < 0 && errno != ENOENT) {
 			perror("ioctl send");
-			goto out;
+			return -1;
 		}
+		ret = 0;
 	} else {
 		// inject the file descriptor into the target process
 		struct seccomp_notif_addfd addfd = {};
 		addfd.id = req->id;
 		addfd.flags = SECCOMP_ADDFD_FLAG_SEND; // add the fd and return it, atomically
-		addfd.srcfd = ret;
-		resp->val = ret;
+		addfd.srcfd = (int) result;
+		// close-on-exec is a property of the descriptor, not of the open file, so it needs to be passed explicitly
+		addfd.newfd_flags = p->ctx.open_flags & O_CLOEXEC;
+		resp->val = result;
 		// note that this branch does not need the SECCOMP_IOCTL_NOTIF_SEND, because this ADDFD call already includes it due to the SECCOMP_ADDFD_FLAG_SEND flag
 		ret = ioctl(listener, SECCOMP_IOCTL_NOTIF_ADDFD, &addfd);
+		const int err = errno;
+		// we need to close the fd on our side, it will still be open on the target side, since we already sent it above
+		close(addfd.srcfd);
 		if (ret == -1) {
+			if (err == ENOENT) {
+				// the task was killed, or a signal interrupted the syscall, which the task restarts by itself
+				return 0;
+			}
 			perror("SECCOMP_IOCTL_NOTIF_ADDFD");
-			goto out;
+			// the fd could not be installed in the task, for example because it ran out of descriptors
+			return fail_req(resp, listener, -err);
 		}
 		resp->error = 0;
-		// we need to close the fd on our side, it will still be open on the target side, since we already sent it above
-		close(addfd.srcfd);
 	}
-out:
-	if (proxy_dirfd >= 0) {
-		close(proxy_dirfd);
+	return ret;
+}
+
+/*
+ * Closes everything that resolve_req() opened for the request
+ */
+static void release_req(struct pending_req *p)
+{
+	if (p->ctx.proxy_dirfd >= 0) {
+		close(p->ctx.proxy_dirfd);
+	}
+	if (p->mem >= 0) {
+		close(p->mem);
+	}
+}
+
+/*
+ * Runs the handler of the request p->req synchronously and answers it
+ * Returns 0 on success or -1 on error.
+ */
+static int serve_req(struct pending_req *p, struct seccomp_notif_resp *resp, int listener)
+{
+	if (!p->remaining_ns) {
+		return complete_req(p, resp, listener, p->desc->handler(&p->ctx));
 	}
-	close(mem);
+	const unsigned long long start = stats_now_ns();
+	const long result = p->desc->handler(&p->ctx);
+	overload_served(p->ctx.rule, stats_now_ns() - start);
+	return complete_req(p, resp, listener, result);
+}
+
+int handle_req(struct seccomp_notif *req,
+		      struct seccomp_notif_resp *resp, int listener)
+{
+	struct pending_req p = { .req = req };
+	if (rules_have_budgets()) {
+		p.received_ns = stats_now_ns();
+	}
+	int ret = resolve_req(&p, resp, listener);
+	if (ret > 0) {
+		// Make the final system call on behalf of the task
+		ret = serve_req(&p, resp, listener);
+	}
+	release_req(&p);
 	return ret;
 }
+
+// the requests of the current batch
+static struct pending_req batch[MAX_BATCH_SIZE];
+
+// the context of uring_submit() callbacks
+struct batch_ctx {
+	struct seccomp_notif_resp *resp;
+	int listener;
+	int ret;
+};
+
+static void complete_batched(unsigned long long user_data, int res, void *arg)
+{
+	struct batch_ctx *b = arg;
+	struct pending_req *p = &batch[user_data];
+	int ret;
+	if (p->remaining_ns && (res == -ECANCELED || res == -EINTR || res == -ETIME)) {
+		// the linked timeout cancelled the open or interrupted it while it was blocked, or the batch stopped waiting for it,
+		// because it ran out of its latency budget
+		b->resp->id = p->req->id;
+		b->resp->flags = 0;
+		if (overload_expired(p->ctx.rule) == OVERLOAD_CONTINUE) {
+			ret = continue_req(b->resp, b->listener);
+		} else {
+			ret = fail_req(b->resp, b->listener, -EAGAIN);
+		}
+	} else {
+		if (p->remaining_ns) {
+			overload_served(p->ctx.rule, stats_now_ns() - p->started_ns);
+		}
+		ret = complete_req(p, b->resp, b->listener, res);
+	}
+	if (ret < 0) {
+		b->ret = -1;
+	}
+	release_req(p);
+	p->queued = false;
+}
+
+int handle_batch(struct seccomp_notif *req, struct seccomp_notif_resp *resp, int listener, size_t notif_size)
+{
+	// the notifications were pending at least since the supervisor woke up
+	const unsigned long long received = rules_have_budgets() ? stats_now_ns() : 0;
+	// the first request was received already, drain all others that are pending right now without blocking
+	batch[0].req = req;
+	size_t size = 1;
+	struct pollfd pfd = { .fd = listener, .events = POLLIN };
+	while (size < MAX_BATCH_SIZE && poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+		if (batch[size].req == NULL && (batch[size].req = malloc(notif_size)) == NULL) {
+			break;
+		}
+		memset(batch[size].req, 0, notif_size);
+		if (ioctl(listener, SECCOMP_IOCTL_NOTIF_RECV, batch[size].req)) {
+			// the task died in between, everything else is left to the main loop
+			break;
+		}
+		size++;
+	}
+	stats.batches++;
+	overload_wakeup(size);
+
+	// answer everything right away, except for plain opens, which are submitted together
+	struct batch_ctx b = { .resp = resp, .listener = listener, .ret = 0 };
+	size_t queued = 0;
+	// how long to wait for the queued opens, or 0 if one of them has no budget
+	unsigned long long timeout = CANCEL_GRACE_NS;
+	for (size_t i = 0; i < size; ++i) {
+		struct pending_req *p = &batch[i];
+		p->received_ns = received;
+		int ret = resolve_req(p, resp, listener);
+		if (ret > 0) {
+			struct open_how how;
+			bool openat2;
+			if (uring_enabled && redirect_open_args(&p->ctx, &how, &openat2)
+				&& uring_queue_open(p->ctx.proxy_dirfd, p->ctx.proxy_pathname, openat2 ? &p->ctx.how : &how, openat2, p->remaining_ns, i)) {
+				p->queued = true;
+				p->started_ns = p->remaining_ns ? stats_now_ns() : 0;
+				if (!p->remaining_ns) {
+					timeout = 0;
+				} else if (timeout) {
+					timeout = MAX(timeout, p->remaining_ns + CANCEL_GRACE_NS);
+				}
+				queued++;
+				continue;
+			}
+			ret = serve_req(p, resp, listener);
+		}
+		if (ret < 0) {
+			b.ret = -1;
+		}
+		release_req(p);
+	}
+
+	if (queued) {
+		stats.batched += queued;
+		if (uring_submit(complete_batched, &b, timeout) < 0) {
+			// io_uring broke down, so fall back to opening synchronously, except for opens with a budget, which could not be bounded anymore
+			uring_enabled = false;
+			uring_failed = true;
+		}
+		for (size_t i = 0; i < size; ++i) {
+			if (batch[i].queued) {
+				complete_batched(i, batch[i].remaining_ns ? -ETIME : (int) batch[i].desc->handler(&batch[i].ctx), &b);
+			}
+		}
+	}
+	return b.ret;
+}
@@ -3,21 +3,34 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <seccomp.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "copycat.h"
 #include "seccomp_trap.h"
 
 struct seccomp_state {
 	int sk_pair[2];
 	int listener;
 	pid_t task_pid;
+	// the supervisor end of the control socket for nested copycat instances
+	int control;
+	// the kinds of access that the filter traps
+	enum rule_access access;
+	// bitmask over syscall_descs of the trapped syscalls
+	uint64_t trapped;
 };
 
 void handle_child_exit(int);
 int seccomp_child(const char *file, char *const argv[], struct seccomp_state *state);
 int seccomp_parent(struct seccomp_state *state);
 int seccomp_exec(const char *file, char *const argv[]);
+void seccomp_set_batch(bool enabled);
+void seccomp_set_supervisor_options(const char *options);
 int pidfd_open(pid_t pid, unsigned int flags);
 int pidfd_getfd(int pidfd, int targetfd, unsigned int flags);
-int handle_req(struct seccomp_notif *req, struct seccomp_notif_resp *resp, int listener, int pidfd);
+int task_getfd(pid_t tid, int targetfd);
+int continue_req(struct seccomp_notif_resp *resp, int listener);
+int handle_req(struct seccomp_notif *req, struct seccomp_notif_resp *resp, int listener);
+int handle_batch(struct seccomp_notif *req, struct seccomp_notif_resp *resp, int listener, size_t notif_size);
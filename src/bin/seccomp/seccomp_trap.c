@@ -7,7 +7,7 @@
 #include <linux/seccomp.h>
 
 // the maximum size of the BPF filter code
-#define MAX_FILTER_SIZE 16
+#define MAX_FILTER_SIZE 128
 #define X32_SYSCALL_BIT 0x40000000
 
 int seccomp(unsigned int op, unsigned int flags, void *args)
@@ -66,14 +66,24 @@ int recv_fd(int sock)
 	}
 
 	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL) {
+		// the other end was closed without sending a file descriptor
+		return -1;
+	}
 
 	return *((int *)CMSG_DATA(cmsg));
 }
 
-int user_trap_syscalls(const int *nrs, size_t length, unsigned int flags) {
+int user_trap_syscalls(const struct syscall_trap *traps, size_t length, unsigned int flags) {
 	struct sock_filter filter[MAX_FILTER_SIZE];
 	int i = 0;
 
+	// every syscall needs at most 5 instructions, see below
+	if (5 + 5 * length + 1 > MAX_FILTER_SIZE) {
+		errno = E2BIG;
+		return -1;
+	}
+
 	// load arch
 	filter[i++] = (struct sock_filter) BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, arch));
 
@@ -90,24 +100,35 @@ int user_trap_syscalls(const int *nrs, size_t length, unsigned int flags) {
 	filter[i++] = (struct sock_filter) BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_KILL_PROCESS);
 
 	// now with the syscall nr still loaded, dynamically add checks for all syscall nrs we want to intercept
-	for (int j = 0; j < length; ++j) {
-		// jump if equal
-		filter[i].code = (unsigned short) BPF_JMP+BPF_JEQ+BPF_K;
-		// if equal (found a matching syscall), jump to early SECCOMP_RET_USER_NOTIF return
-		// the jump distance is the difference between the current index and the last index of this for loop series (which has index len - 1), plus two to jump from the last index inside the for loop to the actual intended location, but again minus one, because BPF does one implicit jump forward on each instruction
-		filter[i].jt = (length - 1) - j + 2 - 1;
-		// if not equal (no matching syscall yet), try the next syscall nr in the next line (so don't jump at all)
-		filter[i].jf = 0;
-		// match against the syscall nr
-		filter[i++].k = nrs[j];
+	for (size_t j = 0; j < length; ++j) {
+		const struct syscall_trap *t = &traps[j];
+		// the body that follows the syscall nr check always returns, so it never clobbers the loaded syscall nr for the next check
+		const unsigned char body_size = t->condition == TRAP_ALWAYS ? 1 : 4;
+
+		// if equal (found a matching syscall), continue with the body right below
+		// if not equal, jump over the body to the check for the next syscall nr
+		filter[i++] = (struct sock_filter) BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, t->nr, 0, body_size);
+
+		if (t->condition != TRAP_ALWAYS) {
+			// load the lower 32 bits of the argument, x86_64 is little endian
+			filter[i++] = (struct sock_filter) BPF_STMT(BPF_LD+BPF_W+BPF_ABS, offsetof(struct seccomp_data, args) + t->arg * sizeof(__u64));
+			// jump to the notification if the condition holds, otherwise to the early SECCOMP_RET_ALLOW
+			if (t->condition == TRAP_IF_ANY_SET) {
+				filter[i++] = (struct sock_filter) BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, t->mask, 0, 1);
+			} else {
+				filter[i++] = (struct sock_filter) BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, t->mask, 1, 0);
+			}
+		}
+		filter[i++] = (struct sock_filter) BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_USER_NOTIF);
+		if (t->condition != TRAP_ALWAYS) {
+			// the supervisor would not change anything about this call, so let the kernel handle it right away
+			filter[i++] = (struct sock_filter) BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW);
+		}
 	}
 
 	// didn't find a matching syscall, so return allow
 	filter[i++] = (struct sock_filter) BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW);
 
-	// this is the jump target. If we found a matching syscall, we return SECCOMP_RET_USER_NOTIF
-	filter[i++] = (struct sock_filter) BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_USER_NOTIF);
-
 	struct sock_fprog prog = {
 		// i points to the next (still unused) index, so it is equal to the actual length
 		.len = (unsigned short) i,
@@ -22,7 +22,25 @@
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
 
+// decides in the kernel whether a trapped syscall needs to notify the supervisor at all
+enum trap_condition {
+	// always notify
+	TRAP_ALWAYS,
+	// only notify if any bit of mask is set in the argument
+	TRAP_IF_ANY_SET,
+	// only notify if no bit of mask is set in the argument
+	TRAP_IF_NONE_SET,
+};
+
+struct syscall_trap {
+	int nr;
+	enum trap_condition condition;
+	// index of the argument that the condition checks
+	int arg;
+	unsigned int mask;
+};
+
 int seccomp(unsigned int op, unsigned int flags, void *args);
 int send_fd(int sock, int fd);
 int recv_fd(int sock);
-int user_trap_syscalls(const int *nrs, size_t length, unsigned int flags);
+int user_trap_syscalls(const struct syscall_trap *traps, size_t length, unsigned int flags);
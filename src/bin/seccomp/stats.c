@@ -0,0 +1,25 @@
+#include "stats.h"
+
+struct copycat_stats stats = {0};
+
+unsigned long long stats_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void stats_print(FILE *f) {
+	fprintf(f, "copycat: %lu trapped syscalls, %lu redirected, %lu continued\n", stats.requests, stats.redirected, stats.continued);
+	if (stats.batches) {
+		fprintf(f, "copycat: %lu batches of up to %lu notifications, %lu opens submitted through io_uring\n", stats.batches, stats.max_queue_depth, stats.batched);
+	}
+	if (stats.overload_fail_open || stats.overload_fail_closed || stats.overload_probes) {
+		fprintf(f, "copycat: over budget %lu times failing open and %lu times failing closed, %lu of which expired while served, %lu because of the queue depth, %lu probes\n",
+			stats.overload_fail_open, stats.overload_fail_closed, stats.overload_expired, stats.overload_queued, stats.overload_probes);
+	}
+	if (stats.resolver_calls || stats.resolver_cache_hits) {
+		fprintf(f, "copycat: resolver called %lu times (avg %llu ns, max %llu ns), %lu answered from cache\n",
+			stats.resolver_calls, stats.resolver_calls ? stats.resolver_ns_total / stats.resolver_calls : 0,
+			stats.resolver_ns_max, stats.resolver_cache_hits);
+	}
+}
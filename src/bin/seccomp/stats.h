@@ -0,0 +1,45 @@
+#pragma once
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * Counters about the work of the supervisor, printed on exit with --stats
+ */
+struct copycat_stats {
+	bool enabled;
+	// trapped syscalls
+	unsigned long requests;
+	// syscalls that were answered by the supervisor
+	unsigned long redirected;
+	// syscalls that continued unchanged
+	unsigned long continued;
+	// supervisor wake-ups that handled a batch of notifications, and the opens in them that were submitted through io_uring
+	unsigned long batches;
+	unsigned long batched;
+	// requests of rules over their latency budget, that continued unchanged or failed fast, how many of them expired while being served,
+	// how many were over budget because of the requests queued in front of them,
+	// and how many requests were let through to probe whether the rule has recovered
+	unsigned long overload_fail_open;
+	unsigned long overload_fail_closed;
+	unsigned long overload_expired;
+	unsigned long overload_queued;
+	unsigned long overload_probes;
+	// the most notifications that were pending at once
+	unsigned long max_queue_depth;
+	// calls into the resolver plugin, and how many were answered from its memo cache instead
+	unsigned long resolver_calls;
+	unsigned long resolver_cache_hits;
+	unsigned long long resolver_ns_total;
+	unsigned long long resolver_ns_max;
+};
+
+extern struct copycat_stats stats;
+
+/**
+ * Returns the current time of the monotonic clock in nanoseconds
+ */
+unsigned long long stats_now_ns();
+
+void stats_print(FILE *f);
@@ -0,0 +1,346 @@
+#include "syscall_handlers.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <linux/openat2.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "dir_cache.h"
+#include "file_cache.h"
+#include "memfd_cache.h"
+#include "overlay.h"
+#include "syscalls/openat2.h"
+#include "seccomp_exec.h"
+#include "task_cache.h"
+#include "util.h"
+
+// returns the argument with index i as a pointer into the task's memory
+#define ARG_PTR(ctx, i) ((ctx)->req->data.args[i])
+#define ARG_INT(ctx, i) ls_int((ctx)->req->data.args[i])
+
+static long result_or_errno(long ret) {
+	return ret < 0 ? -errno : ret;
+}
+
+/*
+ * Writes the result buffer back into the task's memory with a single system call
+ */
+static long write_back(struct req_ctx *ctx, unsigned long long addr, const void *buf, size_t len) {
+	struct iovec local = { (void *) buf, len };
+	struct iovec remote = { (void *) addr, len };
+	if (process_vm_writev(ctx->req->pid, &local, 1, &remote, 1, 0) != (ssize_t) len) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/*
+ * Opens the redirected path, taking into account how the rule serves its destination
+ */
+static long redirect_open(struct req_ctx *ctx, int flags, mode_t mode, struct open_how *how) {
+	ctx->open_flags = flags;
+	if (ctx->rule->mode == RULE_OVERLAY && (open_flags_access(flags) & ACCESS_WRITE)
+		&& overlay_copy_up(ctx->pathname, ctx->proxy_pathname, flags & O_TRUNC) < 0) {
+		// the first write needs a copy of the original in the overlay
+		return -errno;
+	}
+
+	long ret;
+	if (ctx->rule->mode == RULE_ZSTD) {
+		// serve the decompressed content instead
+		ret = memfd_cache_open(ctx->proxy_dirfd, ctx->proxy_pathname, flags);
+	} else if (ctx->rule->mode == RULE_CACHE) {
+		// serve a local copy instead
+		ret = file_cache_open(ctx->proxy_dirfd, ctx->proxy_pathname, flags, mode);
+	} else if (how != NULL) {
+		ret = openat2(ctx->proxy_dirfd, ctx->proxy_pathname, how, sizeof(struct open_how));
+	} else {
+		// This will resolve to our overloaded syscall
+		ret = openat(ctx->proxy_dirfd, ctx->proxy_pathname, flags, mode);
+	}
+	return result_or_errno(ret);
+}
+
+bool redirect_open_args(struct req_ctx *ctx, struct open_how *how, bool *openat2) {
+	if (ctx->rule->mode != RULE_REDIRECT) {
+		// other modes serve something else than the destination itself
+		return false;
+	}
+	*openat2 = false;
+	switch (ctx->req->data.nr) {
+	case __NR_open:
+		*how = (struct open_how) { .flags = (unsigned) ARG_INT(ctx, 1), .mode = (mode_t) ARG_INT(ctx, 2) };
+		break;
+	case __NR_openat:
+		*how = (struct open_how) { .flags = (unsigned) ARG_INT(ctx, 2), .mode = (mode_t) ARG_INT(ctx, 3) };
+		break;
+	case __NR_openat2:
+		*how = ctx->how;
+		*openat2 = true;
+		break;
+	default:
+		return false;
+	}
+	ctx->open_flags = how->flags;
+	return true;
+}
+
+static long handle_open(struct req_ctx *ctx) {
+	return redirect_open(ctx, ARG_INT(ctx, 1), (mode_t) ARG_INT(ctx, 2), NULL);
+}
+
+static long handle_openat(struct req_ctx *ctx) {
+	return redirect_open(ctx, ARG_INT(ctx, 2), (mode_t) ARG_INT(ctx, 3), NULL);
+}
+
+static long handle_openat2(struct req_ctx *ctx) {
+	return redirect_open(ctx, ctx->how.flags, ctx->how.mode, &ctx->how);
+}
+
+/*
+ * Stats the redirected path
+ * Compressed destinations report the size of their decompressed content, so that the result is consistent with what an open sees.
+ */
+static long redirect_stat(struct req_ctx *ctx, struct stat *st, int flags) {
+	if (fstatat(ctx->proxy_dirfd, ctx->proxy_pathname, st, flags) < 0) {
+		return -errno;
+	}
+	if (ctx->rule->mode == RULE_ZSTD && S_ISREG(st->st_mode)) {
+		const off_t size = memfd_cache_size(ctx->proxy_dirfd, ctx->proxy_pathname);
+		if (size >= 0) {
+			st->st_size = size;
+			// in 512 byte units
+			st->st_blocks = (size + 511) / 512;
+		}
+	}
+	return 0;
+}
+
+static long stat_and_write_back(struct req_ctx *ctx, unsigned long long buf, int flags) {
+	struct stat st;
+	long ret = redirect_stat(ctx, &st, flags);
+	return ret < 0 ? ret : write_back(ctx, buf, &st, sizeof(st));
+}
+
+static long handle_stat(struct req_ctx *ctx) {
+	return stat_and_write_back(ctx, ARG_PTR(ctx, 1), 0);
+}
+
+static long handle_lstat(struct req_ctx *ctx) {
+	return stat_and_write_back(ctx, ARG_PTR(ctx, 1), AT_SYMLINK_NOFOLLOW);
+}
+
+static long handle_newfstatat(struct req_ctx *ctx) {
+	return stat_and_write_back(ctx, ARG_PTR(ctx, 2), ARG_INT(ctx, 3));
+}
+
+static long handle_statx(struct req_ctx *ctx) {
+	struct statx stx;
+	if (statx(ctx->proxy_dirfd, ctx->proxy_pathname, ARG_INT(ctx, 2), (unsigned int) ARG_INT(ctx, 3), &stx) < 0) {
+		return -errno;
+	}
+	if (ctx->rule->mode == RULE_ZSTD && S_ISREG(stx.stx_mode)) {
+		struct stat st;
+		if (!redirect_stat(ctx, &st, 0)) {
+			stx.stx_size = st.st_size;
+			stx.stx_blocks = st.st_blocks;
+		}
+	}
+	return write_back(ctx, ARG_PTR(ctx, 4), &stx, sizeof(stx));
+}
+
+static long redirect_access(struct req_ctx *ctx, int mode, int flags) {
+	// faccessat2 is the only variant that takes flags
+	return result_or_errno(syscall(__NR_faccessat2, ctx->proxy_dirfd, ctx->proxy_pathname, mode, flags));
+}
+
+static long handle_access(struct req_ctx *ctx) {
+	return redirect_access(ctx, ARG_INT(ctx, 1), 0);
+}
+
+static long handle_faccessat(struct req_ctx *ctx) {
+	return redirect_access(ctx, ARG_INT(ctx, 2), 0);
+}
+
+static long handle_faccessat2(struct req_ctx *ctx) {
+	return redirect_access(ctx, ARG_INT(ctx, 2), ARG_INT(ctx, 3));
+}
+
+static long redirect_readlink(struct req_ctx *ctx, unsigned long long buf, int bufsiz) {
+	if (bufsiz <= 0) {
+		return -EINVAL;
+	}
+	char target[PATH_MAX];
+	ssize_t len = readlinkat(ctx->proxy_dirfd, ctx->proxy_pathname, target, sizeof(target));
+	if (len < 0) {
+		return -errno;
+	}
+	// readlink silently truncates to the size of the buffer
+	len = MIN(len, bufsiz);
+	long ret = write_back(ctx, buf, target, len);
+	return ret < 0 ? ret : len;
+}
+
+static long handle_readlink(struct req_ctx *ctx) {
+	return redirect_readlink(ctx, ARG_PTR(ctx, 1), ARG_INT(ctx, 2));
+}
+
+static long handle_readlinkat(struct req_ctx *ctx) {
+	return redirect_readlink(ctx, ARG_PTR(ctx, 2), ARG_INT(ctx, 3));
+}
+
+static long handle_getdents64(struct req_ctx *ctx) {
+	const struct dir_listing *listing = dir_cache_get(ctx->pathname, ctx->proxy_pathname);
+	if (listing == NULL) {
+		return -errno;
+	}
+
+	// the file offset of the task's directory descriptor is the cursor into the merged listing,
+	// this way rewinddir() and seekdir() work without telling us
+	int fd = task_getfd(ctx->req->pid, ARG_INT(ctx, 0));
+	if (fd < 0) {
+		return -errno;
+	}
+	long ret = 0;
+	off_t index = lseek(fd, 0, SEEK_CUR);
+	if (index < 0) {
+		ret = -errno;
+	} else if ((size_t) index < listing->count) {
+		// hand out as many records as fit into the buffer
+		size_t bufsiz = (size_t) ARG_INT(ctx, 2);
+		size_t end = index;
+		while (end < listing->count && listing->offsets[end + 1] - listing->offsets[index] <= bufsiz) {
+			end++;
+		}
+		if (end == (size_t) index) {
+			ret = -EINVAL;
+		} else {
+			size_t len = listing->offsets[end] - listing->offsets[index];
+			ret = write_back(ctx, ARG_PTR(ctx, 1), listing->records + listing->offsets[index], len);
+			if (ret == 0 && lseek(fd, end, SEEK_SET) < 0) {
+				ret = -errno;
+			}
+			if (ret == 0) {
+				ret = len;
+			}
+		}
+	}
+	close(fd);
+	return ret;
+}
+
+/*
+ * Removes a file or directory below an overlay
+ * Only what was created in the overlay can be removed, removing the original would modify the source directory.
+ */
+static long overlay_remove(struct req_ctx *ctx, int flags) {
+	struct stat st;
+	if (lstat(ctx->pathname, &st) == 0 || errno != ENOENT) {
+		return -EROFS;
+	}
+	return result_or_errno(unlinkat(ctx->proxy_dirfd, ctx->proxy_pathname, flags));
+}
+
+static long handle_unlink(struct req_ctx *ctx) {
+	return overlay_remove(ctx, 0);
+}
+
+static long handle_unlinkat(struct req_ctx *ctx) {
+	return overlay_remove(ctx, ARG_INT(ctx, 2) & AT_REMOVEDIR);
+}
+
+static long handle_rmdir(struct req_ctx *ctx) {
+	return overlay_remove(ctx, AT_REMOVEDIR);
+}
+
+/*
+ * Renames a file within overlays
+ * Moving a file into or out of an overlay, or moving or replacing an original, would need to modify the source directory.
+ */
+static long overlay_move(struct req_ctx *ctx, unsigned int flags) {
+	char dest[PATH_MAX];
+	const char *match;
+	const struct rule_t *rule = find_match(&match, ctx->pathname, ACCESS_WRITE, ctx->index);
+	if (rule == NULL || rule->mode != RULE_OVERLAY) {
+		return -EROFS;
+	}
+	// find_match() returns a shared buffer
+	snprintf(dest, sizeof(dest), "%s", match);
+	rule = find_match(&match, ctx->pathname2, ACCESS_WRITE, ctx->index);
+	if (rule == NULL || rule->mode != RULE_OVERLAY) {
+		return -EROFS;
+	}
+	return result_or_errno(overlay_rename(ctx->pathname, dest, ctx->pathname2, match, flags));
+}
+
+static long handle_rename(struct req_ctx *ctx) {
+	return overlay_move(ctx, 0);
+}
+
+static long handle_renameat2(struct req_ctx *ctx) {
+	return overlay_move(ctx, (unsigned int) ARG_INT(ctx, 4));
+}
+
+static bool union_rules_exist() {
+	return rules_have_mode(RULE_UNION) || rules_have_mode(RULE_OVERLAY);
+}
+
+static bool overlay_rules_exist() {
+	return rules_have_mode(RULE_OVERLAY);
+}
+
+static void observe_exec(struct seccomp_notif *req) {
+	// the task will run another executable, so other rules may apply to it
+	task_cache_exec(req->pid);
+}
+
+#define OPEN_DESC(n, path, dirfd, flags, how, h) { .nr = n, .path_arg = path, .dirfd_arg = dirfd, .path2_arg = -1, .dirfd2_arg = -1, .flags_arg = flags, .how_arg = how, .at_flags_arg = -1, .access = ACCESS_ANY, .returns_fd = true, .handler = h }
+#define QUERY_DESC(n, path, dirfd, at_flags, h) { .nr = n, .path_arg = path, .dirfd_arg = dirfd, .path2_arg = -1, .dirfd2_arg = -1, .flags_arg = -1, .how_arg = -1, .at_flags_arg = at_flags, .access = ACCESS_READ, .returns_fd = false, .handler = h }
+#define OBSERVE_DESC(n, need, o) { .nr = n, .path_arg = -1, .dirfd_arg = -1, .path2_arg = -1, .dirfd2_arg = -1, .flags_arg = -1, .how_arg = -1, .at_flags_arg = -1, .access = ACCESS_ANY, .needed = need, .observe = o }
+#define OVERLAY_DESC(n, path, dirfd, path2, dirfd2, h) { .nr = n, .path_arg = path, .dirfd_arg = dirfd, .path2_arg = path2, .dirfd2_arg = dirfd2, .flags_arg = -1, .how_arg = -1, .at_flags_arg = -1, .access = ACCESS_WRITE, .needed = overlay_rules_exist, .returns_fd = false, .overlay_only = true, .handler = h }
+
+// list of all syscalls to trap
+const struct syscall_desc syscall_descs[] = {
+	OPEN_DESC(__NR_open, 0, -1, 1, -1, handle_open),
+	OPEN_DESC(__NR_openat, 1, 0, 2, -1, handle_openat),
+	OPEN_DESC(__NR_openat2, 1, 0, -1, 2, handle_openat2),
+	QUERY_DESC(__NR_stat, 0, -1, -1, handle_stat),
+	QUERY_DESC(__NR_lstat, 0, -1, -1, handle_lstat),
+	QUERY_DESC(__NR_newfstatat, 1, 0, 3, handle_newfstatat),
+	QUERY_DESC(__NR_statx, 1, 0, 2, handle_statx),
+	QUERY_DESC(__NR_access, 0, -1, -1, handle_access),
+	QUERY_DESC(__NR_faccessat, 1, 0, -1, handle_faccessat),
+	QUERY_DESC(__NR_faccessat2, 1, 0, 3, handle_faccessat2),
+	QUERY_DESC(__NR_readlink, 0, -1, -1, handle_readlink),
+	QUERY_DESC(__NR_readlinkat, 1, 0, -1, handle_readlinkat),
+	{ .nr = __NR_getdents64, .path_arg = -1, .dirfd_arg = 0, .path2_arg = -1, .dirfd2_arg = -1, .flags_arg = -1, .how_arg = -1, .at_flags_arg = -1, .access = ACCESS_READ, .needed = union_rules_exist, .returns_fd = false, .handler = handle_getdents64 },
+	OVERLAY_DESC(__NR_unlink, 0, -1, -1, -1, handle_unlink),
+	OVERLAY_DESC(__NR_unlinkat, 1, 0, -1, -1, handle_unlinkat),
+	OVERLAY_DESC(__NR_rmdir, 0, -1, -1, -1, handle_rmdir),
+	OVERLAY_DESC(__NR_rename, 0, -1, 1, -1, handle_rename),
+	OVERLAY_DESC(__NR_renameat, 1, 0, 3, 2, handle_rename),
+	OVERLAY_DESC(__NR_renameat2, 1, 0, 3, 2, handle_renameat2),
+	OBSERVE_DESC(__NR_execve, rules_depend_on_exec, observe_exec),
+	OBSERVE_DESC(__NR_execveat, rules_depend_on_exec, observe_exec),
+};
+const size_t syscall_descs_size = sizeof(syscall_descs) / sizeof(*syscall_descs);
+static_assert(sizeof(syscall_descs) / sizeof(*syscall_descs) <= 64, "every syscall needs a bit in the trapped mask of seccomp_state");
+
+const struct syscall_desc *syscall_desc_find(int nr) {
+	for (size_t i = 0; i < syscall_descs_size; ++i) {
+		if (syscall_descs[i].nr == nr) {
+			return &syscall_descs[i];
+		}
+	}
+	return NULL;
+}
+
+enum rule_access open_flags_access(int flags) {
+	return flags & OPEN_WRITE_FLAGS ? ACCESS_WRITE : ACCESS_READ;
+}
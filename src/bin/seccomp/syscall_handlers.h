@@ -0,0 +1,93 @@
+#pragma once
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <linux/seccomp.h>
+#include <stddef.h>
+
+#include "copycat.h"
+
+// open flags that make an open count as write access
+#define OPEN_WRITE_FLAGS (O_ACCMODE | O_CREAT | O_TRUNC)
+
+/**
+ * The state of a single trapped system call whose path matched a rule
+ */
+struct req_ctx {
+	struct seccomp_notif *req;
+	int listener;
+	// the opened /proc/pid/mem of the task
+	int mem;
+	const struct rule_t *rule;
+	// the path that matched the rule
+	const char *pathname;
+	// the redirected path, relative to proxy_dirfd
+	const char *proxy_pathname;
+	// the second path of syscalls like rename, or NULL if there is none
+	const char *pathname2;
+	int proxy_dirfd;
+	// the how struct of openat2, already read from the task's memory
+	struct open_how how;
+	// the flags that an injected file descriptor is opened with
+	int open_flags;
+	// the rules that apply to the task
+	rule_index_t index;
+};
+
+/**
+ * Describes how to handle one system call that takes a path
+ */
+struct syscall_desc {
+	int nr;
+	// index of the path argument, or -1 if the syscall operates on the directory referred to by dirfd_arg
+	int path_arg;
+	// index of the dirfd argument, or -1 if the path is always relative to the current working directory
+	int dirfd_arg;
+	// index of a second path argument and its dirfd argument, that is matched if the first path does not match, or -1 if there is none
+	// The handler maps both paths itself.
+	int path2_arg;
+	int dirfd2_arg;
+	// index of the open flags argument, or -1 if there is none
+	int flags_arg;
+	// index of the pointer to the open_how struct, or -1 if there is none
+	int how_arg;
+	// index of the AT_* flags argument, or -1 if there is none
+	int at_flags_arg;
+	// the kind of access, for opens it is only known from the flags
+	enum rule_access access;
+	// returns whether the syscall needs to be trapped for the current rules, or NULL if it always needs to be
+	bool (*needed)();
+	// if set, the syscall is only observed and then continues unchanged
+	void (*observe)(struct seccomp_notif *req);
+	// whether the result is a file descriptor that needs to be injected into the task
+	bool returns_fd;
+	// if set, only overlay rules apply, the syscall continues unchanged for paths of all other rules
+	bool overlay_only;
+	/*
+	 * Runs the system call on the redirected path in the supervisor
+	 * Returns the result of the system call or -errno on error.
+	 */
+	long (*handler)(struct req_ctx *ctx);
+};
+
+extern const struct syscall_desc syscall_descs[];
+extern const size_t syscall_descs_size;
+
+/**
+ * Returns the descriptor for the system call nr, or NULL if it is not trapped
+ */
+const struct syscall_desc *syscall_desc_find(int nr);
+
+/**
+ * Returns the kind of access of opening a file with the given flags
+ */
+enum rule_access open_flags_access(int flags);
+
+/**
+ * Returns whether ctx is a plain redirected open, that can be carried out by anyone with the arguments stored in how
+ *
+ * openat2 is set if the open needs to respect all of how like openat2(2), otherwise only its flags and mode are used like with openat(2).
+ * The open flags are stored in ctx, like the handler would do.
+ */
+bool redirect_open_args(struct req_ctx *ctx, struct open_how *how, bool *openat2);
@@ -0,0 +1,184 @@
+#include "task_cache.h"
+
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TASK_CACHE_SIZE 64
+// how far up the process tree to look for the root of a subtree section
+#define MAX_ANCESTORS 32
+
+struct task_entry {
+	pid_t tid;
+	pid_t tgid;
+	// the kept open /proc/tid/stat, reading it fails once the task is gone, even if its tid is reused
+	int stat_fd;
+	unsigned long long start_time;
+	// the address of the code segment changes on exec
+	unsigned long start_code;
+	rule_index_t index;
+};
+
+static struct task_entry cache[TASK_CACHE_SIZE];
+static bool initialized = false;
+
+/*
+ * Reads the start time and the start of the code segment from /proc/tid/stat
+ */
+static bool read_stat(int fd, unsigned long long *start_time, unsigned long *start_code) {
+	char buf[1024];
+	ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0) {
+		return false;
+	}
+	buf[len] = '\0';
+	// the command name may contain spaces and parentheses, so start parsing after the last parenthesis
+	const char *p = strrchr(buf, ')');
+	if (p == NULL) {
+		return false;
+	}
+	// the fields following the command name start with field 3, start time is field 22 and start code is field 26
+	return sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu %*u %*d %*u %lu",
+		start_time, start_code) == 2;
+}
+
+static bool read_file(const char *path, char *buf, size_t size) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	ssize_t len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0) {
+		return false;
+	}
+	buf[len] = '\0';
+	return true;
+}
+
+/*
+ * Returns the value of the field like "Tgid:" in the content of /proc/pid/status, or fallback if it is missing
+ */
+static pid_t status_field(const char *status, const char *field, pid_t fallback) {
+	const char *p = strstr(status, field);
+	return p != NULL ? (pid_t) strtol(p + strlen(field), NULL, 10) : fallback;
+}
+
+/*
+ * Collects the process tgid followed by all of its parent processes into ancestors
+ */
+static size_t read_ancestors(pid_t tgid, const char *status, pid_t *ancestors) {
+	char path[64], buf[4096];
+	size_t size = 0;
+	ancestors[size++] = tgid;
+	pid_t ppid = status_field(status, "\nPPid:", 0);
+	while (ppid > 1 && size < MAX_ANCESTORS) {
+		ancestors[size++] = ppid;
+		snprintf(path, sizeof(path), "/proc/%d/status", ppid);
+		if (!read_file(path, buf, sizeof(buf))) {
+			break;
+		}
+		ppid = status_field(buf, "\nPPid:", 0);
+	}
+	return size;
+}
+
+static void task_cache_forget(struct task_entry *e) {
+	if (e->stat_fd >= 0) {
+		close(e->stat_fd);
+	}
+	e->tid = 0;
+	e->stat_fd = -1;
+}
+
+/*
+ * Looks up the identity of the task tid and stores it in e
+ */
+static bool task_cache_fill(struct task_entry *e, pid_t tid) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/stat", tid);
+	e->stat_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (e->stat_fd < 0 || !read_stat(e->stat_fd, &e->start_time, &e->start_code)) {
+		task_cache_forget(e);
+		return false;
+	}
+
+	char exe[PATH_MAX], comm[64], status[4096];
+	snprintf(path, sizeof(path), "/proc/%d/exe", tid);
+	ssize_t len = readlink(path, exe, sizeof(exe) - 1);
+	exe[len < 0 ? 0 : len] = '\0';
+	snprintf(path, sizeof(path), "/proc/%d/comm", tid);
+	if (!read_file(path, comm, sizeof(comm))) {
+		comm[0] = '\0';
+	}
+	comm[strcspn(comm, "\n")] = '\0';
+	snprintf(path, sizeof(path), "/proc/%d/status", tid);
+	if (!read_file(path, status, sizeof(status))) {
+		status[0] = '\0';
+	}
+
+	e->tid = tid;
+	e->tgid = status_field(status, "\nTgid:", tid);
+	pid_t ancestors[MAX_ANCESTORS];
+	size_t ancestors_size = 0;
+	if (rules_have_subtrees()) {
+		ancestors_size = read_ancestors(e->tgid, status, ancestors);
+	}
+	e->index = rules_index(exe, comm, ancestors, ancestors_size);
+	return true;
+}
+
+rule_index_t task_cache_rules(pid_t tid) {
+	if (!rules_have_sections()) {
+		// all rules apply to all tasks
+		return RULE_INDEX_ALL;
+	}
+	if (!initialized) {
+		for (size_t i = 0; i < TASK_CACHE_SIZE; ++i) {
+			cache[i].stat_fd = -1;
+		}
+		initialized = true;
+	}
+
+	struct task_entry *e = &cache[tid % TASK_CACHE_SIZE];
+	if (e->tid == tid) {
+		unsigned long long start_time;
+		unsigned long start_code;
+		if (read_stat(e->stat_fd, &start_time, &start_code) && start_time == e->start_time && start_code == e->start_code) {
+			return e->index;
+		}
+	}
+
+	// the task is new, has exec'd or was replaced by another task with the same tid
+	task_cache_forget(e);
+	if (!task_cache_fill(e, tid)) {
+		// we cannot tell what this task is, so only global rules apply
+		return rules_index(NULL, NULL, NULL, 0);
+	}
+	return e->index;
+}
+
+void task_cache_exec(pid_t tid) {
+	if (!initialized) {
+		return;
+	}
+	struct task_entry *e = &cache[tid % TASK_CACHE_SIZE];
+	pid_t tgid = e->tid == tid ? e->tgid : tid;
+	for (size_t i = 0; i < TASK_CACHE_SIZE; ++i) {
+		if (cache[i].tid == tid || cache[i].tgid == tgid) {
+			task_cache_forget(&cache[i]);
+		}
+	}
+}
+
+void task_cache_clear() {
+	if (!initialized) {
+		return;
+	}
+	for (size_t i = 0; i < TASK_CACHE_SIZE; ++i) {
+		task_cache_forget(&cache[i]);
+	}
+}
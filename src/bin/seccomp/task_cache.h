@@ -0,0 +1,24 @@
+#pragma once
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+
+#include "copycat.h"
+
+/**
+ * Returns the rules that apply to the task tid, depending on its executable, command name and parent processes
+ *
+ * The identity of each task is cached, keyed by its tid and start time, so that it is only looked up once after every exec.
+ * Validating a cached entry costs a single read of the already opened /proc/tid/stat file.
+ */
+rule_index_t task_cache_rules(pid_t tid);
+
+/**
+ * Forgets the identity of all tasks in the thread group of tid, because tid is about to exec
+ */
+void task_cache_exec(pid_t tid);
+
+/**
+ * Forgets the identity of all tasks, because the rules have changed
+ */
+void task_cache_clear();
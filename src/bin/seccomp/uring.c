@@ -0,0 +1,284 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * The user_data of every entry holds the submission it belongs to, so that completions that arrive after uring_submit()
+ * gave up on them are recognised. The lowest bits are the index of the open in ops, and the highest bit marks linked timeouts.
+ */
+#define USER_DATA_TIMEOUT (1ULL << 63)
+#define USER_DATA_GENERATION_SHIFT 32
+#define USER_DATA_INDEX_MASK ((1ULL << USER_DATA_GENERATION_SHIFT) - 1)
+#define USER_DATA_GENERATION_MASK (~USER_DATA_TIMEOUT & ~USER_DATA_INDEX_MASK)
+
+struct uring_t {
+	int fd;
+	unsigned entries;
+	// operations queued since the last submit
+	unsigned queued;
+	// the submission queue
+	char *sq_ring;
+	size_t sq_ring_size;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	// the completion queue, which may share its mapping with the submission queue
+	char *cq_ring;
+	size_t cq_ring_size;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	// the timeouts of linked timeout entries, indexed like the submission queue entries
+	struct __kernel_timespec *timeouts;
+	// the opens of the current submission, with the user_data of the caller and whether they have completed
+	unsigned long long *ops;
+	bool *done;
+	unsigned ops_size;
+	// counts the submissions, shifted into place for user_data
+	unsigned long long generation;
+};
+
+static struct uring_t ring = { .fd = -1 };
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params) {
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, unsigned long long timeout_ns) {
+	if (!timeout_ns) {
+		return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+	}
+	// stop waiting for completions after timeout_ns
+	struct __kernel_timespec ts = { .tv_sec = timeout_ns / 1000000000ULL, .tv_nsec = timeout_ns % 1000000000ULL };
+	struct io_uring_getevents_arg arg = { .ts = (unsigned long long) &ts };
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+static unsigned long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * Returns true if the kernel supports all operations that we use
+ */
+static bool uring_probe() {
+	const size_t size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = calloc(1, size);
+	if (probe == NULL) {
+		return false;
+	}
+	bool supported = io_uring_register(ring.fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0
+		&& probe->last_op >= IORING_OP_OPENAT2
+		&& (probe->ops[IORING_OP_LINK_TIMEOUT].flags & IO_URING_OP_SUPPORTED)
+		&& (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED)
+		&& (probe->ops[IORING_OP_OPENAT2].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+	return supported;
+}
+
+int uring_init(unsigned entries) {
+	struct io_uring_params params = {};
+	ring.fd = io_uring_setup(entries, &params);
+	if (ring.fd < 0) {
+		return -1;
+	}
+	ring.entries = params.sq_entries;
+
+	ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single_mmap) {
+		ring.sq_ring_size = ring.cq_ring_size = ring.sq_ring_size > ring.cq_ring_size ? ring.sq_ring_size : ring.cq_ring_size;
+	}
+	ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+	if (ring.sq_ring == (char *) MAP_FAILED) {
+		ring.sq_ring = NULL;
+		uring_exit();
+		return -1;
+	}
+	ring.cq_ring = single_mmap ? ring.sq_ring : mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+	if (ring.cq_ring == (char *) MAP_FAILED) {
+		ring.cq_ring = NULL;
+		uring_exit();
+		return -1;
+	}
+	ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+	if (ring.sqes == MAP_FAILED) {
+		ring.sqes = NULL;
+		uring_exit();
+		return -1;
+	}
+
+	ring.sq_head = (void *) (ring.sq_ring + params.sq_off.head);
+	ring.sq_tail = (void *) (ring.sq_ring + params.sq_off.tail);
+	ring.sq_mask = (void *) (ring.sq_ring + params.sq_off.ring_mask);
+	ring.sq_array = (void *) (ring.sq_ring + params.sq_off.array);
+	ring.cq_head = (void *) (ring.cq_ring + params.cq_off.head);
+	ring.cq_tail = (void *) (ring.cq_ring + params.cq_off.tail);
+	ring.cq_mask = (void *) (ring.cq_ring + params.cq_off.ring_mask);
+	ring.cqes = (void *) (ring.cq_ring + params.cq_off.cqes);
+	ring.timeouts = calloc(ring.entries, sizeof(*ring.timeouts));
+	ring.ops = calloc(ring.entries, sizeof(*ring.ops));
+	ring.done = calloc(ring.entries, sizeof(*ring.done));
+	if (ring.timeouts == NULL || ring.ops == NULL || ring.done == NULL) {
+		uring_exit();
+		return -1;
+	}
+
+	// waiting with a timeout needs IORING_ENTER_EXT_ARG
+	if (!(params.features & IORING_FEAT_EXT_ARG) || !uring_probe()) {
+		uring_exit();
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	return 0;
+}
+
+void uring_exit() {
+	free(ring.timeouts);
+	free(ring.ops);
+	free(ring.done);
+	if (ring.sqes != NULL) {
+		munmap(ring.sqes, ring.sqes_size);
+	}
+	if (ring.cq_ring != NULL && ring.cq_ring != ring.sq_ring) {
+		munmap(ring.cq_ring, ring.cq_ring_size);
+	}
+	if (ring.sq_ring != NULL) {
+		munmap(ring.sq_ring, ring.sq_ring_size);
+	}
+	if (ring.fd >= 0) {
+		close(ring.fd);
+	}
+	ring = (struct uring_t) { .fd = -1 };
+}
+
+// Returns the next free submission queue entry, or NULL if the ring is full
+static struct io_uring_sqe *next_sqe(unsigned *index) {
+	// we are the only producer, but the kernel consumes entries concurrently
+	const unsigned tail = *ring.sq_tail;
+	if (tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >= ring.entries) {
+		return NULL;
+	}
+	*index = tail & *ring.sq_mask;
+	struct io_uring_sqe *sqe = &ring.sqes[*index];
+	memset(sqe, 0, sizeof(*sqe));
+	ring.sq_array[*index] = *index;
+	__atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring.queued++;
+	return sqe;
+}
+
+bool uring_queue_open(int dirfd, const char *path, const struct open_how *how, bool openat2, unsigned long long timeout_ns, unsigned long long user_data) {
+	if (ring.fd < 0 || *ring.sq_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) + (timeout_ns ? 2 : 1) > ring.entries) {
+		return false;
+	}
+	unsigned index;
+	struct io_uring_sqe *sqe = next_sqe(&index);
+	sqe->fd = dirfd;
+	sqe->addr = (unsigned long long) path;
+	ring.ops[ring.ops_size] = user_data;
+	ring.done[ring.ops_size] = false;
+	sqe->user_data = ring.generation | ring.ops_size++;
+	if (openat2) {
+		sqe->opcode = IORING_OP_OPENAT2;
+		sqe->len = sizeof(*how);
+		sqe->addr2 = (unsigned long long) how;
+	} else {
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->len = how->mode;
+		sqe->open_flags = how->flags;
+	}
+	if (timeout_ns) {
+		// the timeout applies to the entry right before it
+		sqe->flags |= IOSQE_IO_LINK;
+		sqe = next_sqe(&index);
+		ring.timeouts[index] = (struct __kernel_timespec) { .tv_sec = timeout_ns / 1000000000ULL, .tv_nsec = timeout_ns % 1000000000ULL };
+		sqe->opcode = IORING_OP_LINK_TIMEOUT;
+		sqe->fd = -1;
+		sqe->addr = (unsigned long long) &ring.timeouts[index];
+		sqe->len = 1;
+		sqe->user_data = ring.generation | USER_DATA_TIMEOUT;
+	}
+	return true;
+}
+
+int uring_submit(void (*complete)(unsigned long long user_data, int res, void *arg), void *arg, unsigned long long timeout_ns) {
+	unsigned to_submit = ring.queued;
+	unsigned pending = ring.queued;
+	const unsigned long long generation = ring.generation;
+	const unsigned long long deadline = timeout_ns ? now_ns() + timeout_ns : 0;
+	ring.queued = 0;
+	while (pending) {
+		// submit everything and wait for all of it with the same system call, but not past the deadline
+		unsigned long long left = 0;
+		if (deadline) {
+			const unsigned long long now = now_ns();
+			if (now >= deadline) {
+				break;
+			}
+			left = deadline - now;
+		}
+		int ret = io_uring_enter(ring.fd, to_submit, pending, IORING_ENTER_GETEVENTS, left);
+		if (ret < 0 && errno != ETIME) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("io_uring_enter");
+			uring_exit();
+			return -1;
+		}
+		if (ret > 0) {
+			to_submit -= (unsigned) ret < to_submit ? (unsigned) ret : to_submit;
+		}
+
+		unsigned head = *ring.cq_head;
+		const unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head) {
+			const struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+			if ((cqe->user_data & USER_DATA_GENERATION_MASK) != generation) {
+				// an earlier submission gave up on this open, so nobody is interested in the file anymore
+				if (!(cqe->user_data & USER_DATA_TIMEOUT) && cqe->res >= 0) {
+					close(cqe->res);
+				}
+				continue;
+			}
+			pending--;
+			if (!(cqe->user_data & USER_DATA_TIMEOUT)) {
+				const unsigned i = cqe->user_data & USER_DATA_INDEX_MASK;
+				ring.done[i] = true;
+				complete(ring.ops[i], cqe->res, arg);
+			}
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	// the opens that did not honour their linked timeout are left behind, their late completions are discarded above
+	for (unsigned i = 0; i < ring.ops_size; ++i) {
+		if (!ring.done[i]) {
+			complete(ring.ops[i], -ETIME, arg);
+		}
+	}
+	ring.ops_size = 0;
+	ring.generation = (ring.generation + (1ULL << USER_DATA_GENERATION_SHIFT)) & USER_DATA_GENERATION_MASK;
+	return 0;
+}
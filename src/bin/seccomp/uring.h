@@ -0,0 +1,40 @@
+#pragma once
+
+#define _GNU_SOURCE
+#include <linux/openat2.h>
+#include <stddef.h>
+
+/**
+ * A minimal io_uring, used to submit a batch of opens with a single system call
+ */
+
+/**
+ * Sets up the ring for up to entries queued operations
+ *
+ * Returns 0 on success or -1 if io_uring, waiting with a timeout, or one of the needed operations is not available.
+ */
+int uring_init(unsigned entries);
+
+/**
+ * Tears down the ring
+ */
+void uring_exit();
+
+/**
+ * Queues opening path relative to dirfd
+ *
+ * If openat2 is set, the file is opened like with openat2(2) and how needs to stay valid until uring_submit() returns,
+ * otherwise only the flags and mode of how are used, like with openat(2).
+ * If timeout_ns is not 0, the open is cancelled if it takes longer than that and completes with -ECANCELED.
+ * Returns false if the ring is full or not set up.
+ */
+bool uring_queue_open(int dirfd, const char *path, const struct open_how *how, bool openat2, unsigned long long timeout_ns, unsigned long long user_data);
+
+/**
+ * Submits all queued operations and waits for them to complete, but for no longer than timeout_ns unless it is 0
+ *
+ * complete is called for every queued open with its user_data and its result, which is -errno on error.
+ * Opens that have not completed by the timeout complete with -ETIME, and if they still succeed later, their files are closed.
+ * Returns 0 on success or -1 on error, in which case the ring is torn down and operations may not have completed.
+ */
+int uring_submit(void (*complete)(unsigned long long user_data, int res, void *arg), void *arg, unsigned long long timeout_ns);
@@ -1,5 +1,93 @@
 #include "util.h"
 
+#include <errno.h>
+#include <linux/limits.h>
+#include <string.h>
+#include <sys/stat.h>
+
 int ls_int(unsigned long long val) {
-	return (int) val & 0x0f;
+	return (int) (val & 0xffffffff);
+}
+
+bool join_path(char *buf, size_t size, const char *dir, const char *path) {
+	size_t len = 0;
+	buf[0] = '\0';
+	// the length of the prefix that is known to contain no symlinks
+	size_t resolved = 0;
+
+	// walk both parts component by component, so that "." and ".." are collapsed lexically
+	const char *parts[] = { dir, path };
+	for (size_t p = 0; p < 2; ++p) {
+		const char *s = parts[p];
+		while (*s) {
+			// skip repeated slashes
+			while (*s == '/') {
+				s++;
+			}
+			const char *end = strchrnul(s, '/');
+			size_t n = end - s;
+			if (n == 0 || (n == 1 && s[0] == '.')) {
+				// nothing to add
+			} else if (n == 2 && s[0] == '.' && s[1] == '.') {
+				if (len > resolved) {
+					// the last component may be a symlink, whose parent is somewhere else entirely
+					return false;
+				}
+				// drop the last component again
+				while (len > 0 && buf[len] != '/') {
+					len--;
+				}
+				buf[len] = '\0';
+				resolved = len;
+			} else {
+				if (len + 1 + n + 1 > size) {
+					return false;
+				}
+				buf[len++] = '/';
+				memcpy(buf + len, s, n);
+				len += n;
+				buf[len] = '\0';
+			}
+			s = end;
+		}
+		if (p == 0) {
+			// dir was resolved by the kernel already
+			resolved = len;
+		}
+	}
+
+	if (len == 0) {
+		// the root directory itself
+		if (size < 2) {
+			return false;
+		}
+		buf[len++] = '/';
+		buf[len] = '\0';
+	}
+	return true;
+}
+
+int make_dirs(const char *path, mode_t mode) {
+	char buf[PATH_MAX];
+	if (strlen(path) >= sizeof(buf)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(buf, path);
+
+	// create every prefix that ends right before a slash, and finally the full path
+	for (char *p = buf + 1; ; ++p) {
+		if (*p == '/' || *p == '\0') {
+			char c = *p;
+			*p = '\0';
+			if (mkdir(buf, mode) < 0 && errno != EEXIST) {
+				return -1;
+			}
+			*p = c;
+			if (c == '\0') {
+				break;
+			}
+		}
+	}
+	return 0;
 }
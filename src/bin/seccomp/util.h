@@ -1,5 +1,9 @@
 #pragma once
 
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <sys/types.h>
+
 /**
  * Returns the least significant 32 bit part of a 64 bit integer as int
  *
@@ -9,3 +13,20 @@
  * Read man 2 seccomp for more details
  */
 int ls_int(unsigned long long val);
+
+/**
+ * Joins the absolute directory dir with the relative path into buf
+ *
+ * dir needs to be free of symlinks, like the paths in /proc/pid/fd are.
+ * The result is normalized lexically, i.e. "." and ".." components are collapsed without touching the filesystem.
+ * As a component of path may be a symlink, ".." is only collapsed into components of dir.
+ * Returns false if the result does not fit into buf, or if path contains ".." after a component of its own.
+ */
+bool join_path(char *buf, size_t size, const char *dir, const char *path);
+
+/**
+ * Creates the directory path including all missing parent directories, like mkdir -p
+ *
+ * Returns 0 on success or -1 with errno set.
+ */
+int make_dirs(const char *path, mode_t mode);
@@ -1,5 +1,7 @@
 #include "copycat.h"
 
+#include <assert.h>
+#include <math.h>
 #include <string.h>
 
 #define COPYCAT_ENV "COPYCAT"
@@ -9,23 +11,136 @@ char *copycat_env;
 
 char path_buffer[PATH_MAX];
 
-#define MAX_RULES_SIZE 64
-struct rule_t {
-	const char *source;
-	const char *dest;
-	bool match_prefix;
-	bool replace_prefix_only;
+// sources starting with one of these prefixes only apply to some kinds of access
+static const struct {
+	const char *prefix;
+	enum rule_access access;
+} source_prefixes[] = {
+	{ READ_ONLY_PREFIX, ACCESS_READ },
+	{ WRITE_ONLY_PREFIX, ACCESS_WRITE },
+};
+
+// destinations starting with one of these prefixes are served differently than a plain redirect
+static const struct {
+	const char *prefix;
+	enum rule_mode mode;
+} dest_prefixes[] = {
+	{ ZSTD_PREFIX, RULE_ZSTD },
+	{ CACHE_PREFIX, RULE_CACHE },
+	{ UNION_PREFIX, RULE_UNION },
+	{ OVERLAY_PREFIX, RULE_OVERLAY },
 };
+
+#define MAX_RULES_SIZE 64
+static_assert(MAX_RULES_SIZE <= sizeof(rule_index_t) * 8, "every rule needs a bit in rule_index_t");
 struct rules_t {
 	size_t size;
+	// all rules that are in a non-global section
+	rule_index_t scoped;
+	// whether at least one rule has a latency budget
+	bool budgets;
 	struct rule_t table[MAX_RULES_SIZE];
 } rules = {0};
 
+#define MAX_SECTIONS_SIZE 16
+// the current section after an invalid header, whose rules are dropped until the next valid header
+#define SECTION_INVALID MAX_SECTIONS_SIZE
+#define SECTION_EXE "exe="
+#define SECTION_COMM "comm="
+struct sections_t {
+	size_t size;
+	// the section that newly parsed rules are added to
+	size_t current;
+	// the section that [*] returns to
+	size_t base;
+	// the subtree that newly parsed sections are limited to
+	pid_t subtree;
+	// set when a rule or section did not fit into its table
+	bool overflow;
+	struct section_t table[MAX_SECTIONS_SIZE];
+} sections = { .size = 1 };
+
+// all parsed rule lines, so that they can be handed over to another copycat instance
+struct rules_text_t {
+	char *text;
+	size_t size;
+} rules_text_buffer = {0};
+
+/*
+ * Removes trailing options like "budget=5 fail-closed" from the destination and stores them in rule
+ * Only known options are removed, so destinations may still contain spaces.
+ */
+static void parse_options(char *destination, struct rule_t *rule) {
+	char *option;
+	while ((option = strrchr(destination, ' ')) != NULL) {
+		const char *value = option + 1;
+		if (!strncmp(value, OPTION_BUDGET, strlen(OPTION_BUDGET))) {
+			// given in milliseconds, and it has to fit into an unsigned long long in nanoseconds
+			char *end;
+			const double ms = strtod(value + strlen(OPTION_BUDGET), &end);
+			if (end == value + strlen(OPTION_BUDGET) || *end != '\0' || !isfinite(ms) || ms <= 0 || ms * 1e6 >= 1.8e19) {
+				fprintf(stderr, "Ignoring invalid budget %s\n", value);
+			} else {
+				rule->budget_ns = MAX((unsigned long long) (ms * 1e6), 1ULL);
+			}
+		} else if (!strcmp(value, OPTION_FAIL_OPEN)) {
+			rule->overload = OVERLOAD_FAIL_OPEN;
+		} else if (!strcmp(value, OPTION_FAIL_CLOSED)) {
+			rule->overload = OVERLOAD_FAIL_CLOSED;
+		} else {
+			break;
+		}
+		*option = '\0';
+	}
+}
+
 /*
  * Adds a rule to the rule table that maps source to destination
  * This function assumes that source and destination are not empty strings
  */
 void add_rule(char *source, char *destination) {
+	if (sections.current == SECTION_INVALID) {
+		// never widen the rules of an invalid section to some other section
+		fprintf(stderr, "Ignoring %s in invalid section\n", source);
+		return;
+	}
+	if (rules.size >= MAX_RULES_SIZE) {
+		fprintf(stderr, "Too many rules, ignoring %s\n", source);
+		sections.overflow = true;
+		return;
+	}
+
+	enum rule_access access = ACCESS_ANY;
+	for (size_t i = 0; i < sizeof(source_prefixes) / sizeof(*source_prefixes); ++i) {
+		size_t len = strlen(source_prefixes[i].prefix);
+		if (!strncmp(source, source_prefixes[i].prefix, len)) {
+			source += len;
+			access = source_prefixes[i].access;
+			break;
+		}
+	}
+
+	struct rule_t options = { .overload = OVERLOAD_FAIL_OPEN };
+	parse_options(destination, &options);
+
+	enum rule_mode mode = RULE_REDIRECT;
+	for (size_t i = 0; i < sizeof(dest_prefixes) / sizeof(*dest_prefixes); ++i) {
+		size_t len = strlen(dest_prefixes[i].prefix);
+		if (!strncmp(destination, dest_prefixes[i].prefix, len)) {
+			destination += len;
+			mode = dest_prefixes[i].mode;
+			break;
+		}
+	}
+	if (!*source || !*destination) {
+		return;
+	}
+	if (mode == RULE_OVERLAY && options.budget_ns && options.overload == OVERLOAD_FAIL_OPEN) {
+		// continuing the original syscall would write to the source, or read it although a copy exists already
+		fprintf(stderr, "Overlay rules cannot fail open, %s fails closed\n", source);
+		options.overload = OVERLOAD_FAIL_CLOSED;
+	}
+
 	char *src = strdup(source);
 	char *dest = strdup(destination);
 	bool match_prefix = false;
@@ -38,6 +153,12 @@ void add_rule(char *source, char *destination) {
 		match_prefix = true;
 	}
 
+	if (mode == RULE_UNION || mode == RULE_OVERLAY) {
+		// union and overlay rules always map directories
+		match_prefix = true;
+		replace_prefix_only = true;
+	}
+
 	if (dest[strlen(dest) - 1] == '/') {
 		// trailing slash in destination
 		// replace prefix only
@@ -45,15 +166,84 @@ void add_rule(char *source, char *destination) {
 		replace_prefix_only = true;
 	}
 
-	// actually add the rule
-	rules.table[rules.size].source = src;
-	rules.table[rules.size].dest = dest;
-	rules.table[rules.size].match_prefix = match_prefix;
-	rules.table[rules.size].replace_prefix_only = replace_prefix_only;
+	// actually add the rule, with a fresh load in case a removed rule was at its position before
+	rules.table[rules.size] = (struct rule_t) {
+		.source = src,
+		.dest = dest,
+		.match_prefix = match_prefix,
+		.replace_prefix_only = replace_prefix_only,
+		.mode = mode,
+		.access = access,
+		.section = sections.current,
+		.budget_ns = options.budget_ns,
+		.overload = options.overload,
+	};
+	rules.budgets |= options.budget_ns != 0;
+	if (sections.current) {
+		rules.scoped |= (rule_index_t) 1 << rules.size;
+	}
 	rules.size++;
 }
 
+/*
+ * Starts a new section of rules from a header like [exe=/usr/bin/ld] or [comm=ld]
+ * The header [*] returns to the global section.
+ */
+void parse_section(char *header) {
+	char *end = strchr(header, ']');
+	if (end == NULL) {
+		fprintf(stderr, "Unterminated section [%s\n", header);
+		sections.current = SECTION_INVALID;
+		return;
+	}
+	*end = '\0';
+	if (!strcmp(header, "*") || !*header) {
+		sections.current = sections.base;
+		return;
+	}
+	if (sections.size >= MAX_SECTIONS_SIZE) {
+		fprintf(stderr, "Too many sections, ignoring [%s]\n", header);
+		sections.overflow = true;
+		sections.current = SECTION_INVALID;
+		return;
+	}
+
+	struct section_t *section = &sections.table[sections.size];
+	*section = (struct section_t) { .subtree = sections.subtree };
+	if (!strncmp(header, SECTION_EXE, strlen(SECTION_EXE))) {
+		// tasks are matched by the resolved path of their executable, so resolve symlinks like /usr/bin/ld as well
+		const char *exe = header + strlen(SECTION_EXE);
+		section->exe = realpath(exe, NULL);
+		if (section->exe == NULL) {
+			section->exe = strdup(exe);
+		}
+	} else if (!strncmp(header, SECTION_COMM, strlen(SECTION_COMM))) {
+		section->comm = strdup(header + strlen(SECTION_COMM));
+	} else {
+		fprintf(stderr, "Unknown section [%s]\n", header);
+		sections.current = SECTION_INVALID;
+		return;
+	}
+	sections.current = sections.size++;
+}
+
 void parse_rule(char *line) {
+	// remember the line before it is split up below
+	const size_t len = strlen(line);
+	char *text = realloc(rules_text_buffer.text, rules_text_buffer.size + len + 2);
+	if (text != NULL) {
+		memcpy(text + rules_text_buffer.size, line, len);
+		text[rules_text_buffer.size + len] = '\n';
+		text[rules_text_buffer.size + len + 1] = '\0';
+		rules_text_buffer.text = text;
+		rules_text_buffer.size += len + 1;
+	}
+
+	if (line[0] == '[') {
+		parse_section(line + 1);
+		return;
+	}
+
 	// split line into source and destination
 	char *dest = strchr(line, ' ');
 	if (dest != NULL) {
@@ -78,6 +268,107 @@ void parse_rules(char *rls) {
 	}
 }
 
+// Returns the destination of rule as given in the rules
+static const char *given_dest(const struct rule_t *rule) {
+	return rule->given_dest != NULL ? rule->given_dest : rule->dest;
+}
+
+// Returns true if the rules of section outer apply to all tasks that the rules of section inner apply to
+static bool section_covers(size_t outer, size_t inner) {
+	const struct section_t *o = &sections.table[outer], *i = &sections.table[inner];
+	return (!o->subtree || o->subtree == i->subtree)
+		&& (o->exe == NULL || (i->exe != NULL && !strcmp(o->exe, i->exe)))
+		&& (o->comm == NULL || (i->comm != NULL && !strcmp(o->comm, i->comm)));
+}
+
+// Returns true if the rules a and b were given the same way, apart from their section
+static bool rules_equal(const struct rule_t *a, const struct rule_t *b) {
+	return !strcmp(a->source, b->source) && !strcmp(given_dest(a), given_dest(b))
+		&& a->match_prefix == b->match_prefix && a->replace_prefix_only == b->replace_prefix_only
+		&& a->mode == b->mode && a->access == b->access && a->budget_ns == b->budget_ns && a->overload == b->overload;
+}
+
+// Returns true if some path and kind of access match both a and b
+static bool rules_overlap(const struct rule_t *a, const struct rule_t *b) {
+	const size_t a_len = strlen(a->source), b_len = strlen(b->source);
+	const struct rule_t *shorter = a_len <= b_len ? a : b;
+	return (a->access & b->access) && !strncmp(a->source, b->source, MIN(a_len, b_len))
+		&& (a_len == b_len || shorter->match_prefix);
+}
+
+/*
+ * Removes the rules from position from onwards that an earlier rule applies to the same tasks already
+ * A nested instance inherits the rules of the outer one, so most of its rules would only fill the rule table.
+ * Rules that a later one of them overlaps are kept, as their order decides which one matches.
+ * Overlay rules that are kept share the directory of the earlier one, so that both see the same changes.
+ */
+static void remove_inherited(size_t from) {
+	size_t size = from;
+	for (size_t i = from; i < rules.size; ++i) {
+		struct rule_t rule = rules.table[i];
+		const struct rule_t *same = NULL;
+		for (size_t j = 0; j < from && same == NULL; ++j) {
+			if (rules_equal(&rules.table[j], &rule) && section_covers(rules.table[j].section, rule.section)) {
+				same = &rules.table[j];
+			}
+		}
+		bool overlapped = false;
+		for (size_t j = i + 1; j < rules.size && !overlapped; ++j) {
+			overlapped = rules_overlap(&rules.table[j], &rule);
+		}
+		if (same != NULL && !overlapped) {
+			free((char *) rule.source);
+			free((char *) rule.dest);
+			free((char *) rule.given_dest);
+			continue;
+		}
+		if (same != NULL && rule.mode == RULE_OVERLAY) {
+			rule.given_dest = rule.dest;
+			rule.dest = strdup(same->dest);
+		}
+		rules.scoped &= ~((rule_index_t) 1 << i);
+		if (rule.section) {
+			rules.scoped |= (rule_index_t) 1 << size;
+		}
+		rules.table[size++] = rule;
+	}
+	rules.size = size;
+}
+
+/*
+ * Parses rules that only apply to the process pid and its descendants
+ * Sections in rls are limited to that subtree as well, and rules that apply to the subtree already are skipped.
+ * Returns false and adds no rules at all, if not all of them fit into the rule table.
+ */
+bool parse_subtree_rules(char *rls, pid_t pid) {
+	const struct rules_mark_t mark = rules_mark();
+	const size_t text_size = rules_text_buffer.size;
+	if (sections.size >= MAX_SECTIONS_SIZE) {
+		return false;
+	}
+	sections.table[sections.size] = (struct section_t) { .subtree = pid };
+	sections.base = sections.current = sections.size++;
+	sections.subtree = pid;
+	sections.overflow = false;
+
+	parse_rules(rls);
+
+	// these rules belong to the subtree, not to this instance
+	if (rules_text_buffer.text != NULL) {
+		rules_text_buffer.text[text_size] = '\0';
+		rules_text_buffer.size = text_size;
+	}
+	const bool ok = !sections.overflow;
+	sections.base = sections.current = 0;
+	sections.subtree = 0;
+	if (!ok) {
+		rules_rollback(mark);
+	} else {
+		remove_inherited(mark.rules);
+	}
+	return ok;
+}
+
 void read_config() {
 	FILE *f = fopen(COPYCAT_CONFIG, "r");
 	if (f == NULL) {
@@ -98,9 +389,91 @@ void read_config() {
 	fclose(f);
 }
 
-// Returns true if a match was found
-bool find_match(const char **match, const char *query) {
+// Returns all rule lines that were parsed so far, separated by new lines
+const char *rules_text() {
+	return rules_text_buffer.text != NULL ? rules_text_buffer.text : "";
+}
+
+// Updates whether at least one rule has a latency budget, after rules were removed
+static void update_budgets() {
+	rules.budgets = false;
 	for (size_t i = 0; i < rules.size; ++i) {
+		rules.budgets |= rules.table[i].budget_ns != 0;
+	}
+}
+
+// Returns the current size of the rule tables, so that rules added later can be removed again with rules_rollback()
+struct rules_mark_t rules_mark() {
+	return (struct rules_mark_t) { .rules = rules.size, .sections = sections.size };
+}
+
+// Removes all rules and sections that were added after mark was taken
+void rules_rollback(struct rules_mark_t mark) {
+	for (size_t i = mark.rules; i < rules.size; ++i) {
+		free((char *) rules.table[i].source);
+		free((char *) rules.table[i].dest);
+		free((char *) rules.table[i].given_dest);
+		rules.scoped &= ~((rule_index_t) 1 << i);
+	}
+	rules.size = mark.rules;
+	update_budgets();
+	for (size_t i = mark.sections; i < sections.size; ++i) {
+		free((char *) sections.table[i].exe);
+		free((char *) sections.table[i].comm);
+	}
+	sections.size = mark.sections;
+}
+
+// Removes all rules and sections that are limited to the subtree of pid
+void rules_remove_subtree(pid_t pid) {
+	// the new position of every section that is kept
+	size_t section_map[MAX_SECTIONS_SIZE];
+	size_t size = 0;
+	for (size_t i = 0; i < sections.size; ++i) {
+		section_map[i] = i == 0 || sections.table[i].subtree != pid ? size++ : 0;
+	}
+
+	size = 0;
+	rules.scoped = 0;
+	for (size_t i = 0; i < rules.size; ++i) {
+		struct rule_t rule = rules.table[i];
+		if (rule.section && sections.table[rule.section].subtree == pid) {
+			free((char *) rule.source);
+			free((char *) rule.dest);
+			free((char *) rule.given_dest);
+			continue;
+		}
+		rule.section = section_map[rule.section];
+		if (rule.section) {
+			rules.scoped |= (rule_index_t) 1 << size;
+		}
+		rules.table[size++] = rule;
+	}
+	rules.size = size;
+	update_budgets();
+
+	size = 0;
+	for (size_t i = 0; i < sections.size; ++i) {
+		if (i && sections.table[i].subtree == pid) {
+			free((char *) sections.table[i].exe);
+			free((char *) sections.table[i].comm);
+			continue;
+		}
+		sections.table[size++] = sections.table[i];
+	}
+	sections.size = size;
+}
+
+// Returns the first rule in index that matches, in the order of the rule table
+static const struct rule_t *find_match_in(const char **match, const char *query, enum rule_access access, rule_index_t index) {
+	index &= rules.size < MAX_RULES_SIZE ? ((rule_index_t) 1 << rules.size) - 1 : RULE_INDEX_ALL;
+	for (; index; index &= index - 1) {
+		size_t i = __builtin_ctzll(index);
+		if (!(rules.table[i].access & access)) {
+			// the rule does not apply to this kind of access
+			continue;
+		}
+
 		size_t rulesrc_len = strlen(rules.table[i].source);
 		// check if we have a recursive rule (match only prefix) or if we have to check for a literal match
 		size_t chars_to_compare = rulesrc_len;
@@ -118,18 +491,180 @@ bool find_match(const char **match, const char *query) {
 				result = path_buffer;
 				strcat(result, query + rulesrc_len);
 			}
+			if (rules.table[i].mode == RULE_UNION || rules.table[i].mode == RULE_OVERLAY) {
+				// only entries below the directory that exist in the destination are taken from there,
+				// except that writes to an overlay always go to the destination, which copies the file there first
+				struct stat st;
+				if (query[rulesrc_len] != '/'
+					|| ((rules.table[i].mode == RULE_UNION || !(access & ACCESS_WRITE)) && lstat(result, &st))) {
+					continue;
+				}
+				// directories that exist on both sides are merged, which needs descriptors and paths of the source directory
+				struct stat src_st;
+				if (!(access & ACCESS_WRITE) && S_ISDIR(st.st_mode) && !stat(query, &src_st) && S_ISDIR(src_st.st_mode)) {
+					continue;
+				}
+			}
 			*match = result;
-			return true;
+			return &rules.table[i];
 		}
 	}
 	*match = query;
+	return NULL;
+}
+
+// Returns the matching rule, or NULL if no match was found
+// Only the rules in index are considered, where rules of a section take precedence over global rules
+const struct rule_t *find_match(const char **match, const char *query, enum rule_access access, rule_index_t index) {
+	const rule_index_t scoped = index & rules.scoped;
+	const struct rule_t *rule = NULL;
+	if (scoped) {
+		rule = find_match_in(match, query, access, scoped);
+	}
+	if (rule == NULL) {
+		rule = find_match_in(match, query, access, index & ~scoped);
+	}
+	return rule;
+}
+
+// Returns the union or overlay rule that the directory dir is part of, or NULL if there is none
+// match is set to the corresponding directory in the destination
+const struct rule_t *find_union(const char **match, const char *dir, rule_index_t index) {
+	for (size_t i = 0; i < rules.size; ++i) {
+		if ((rules.table[i].mode != RULE_UNION && rules.table[i].mode != RULE_OVERLAY) || !(index & ((rule_index_t) 1 << i))) {
+			continue;
+		}
+		size_t rulesrc_len = strlen(rules.table[i].source);
+		if (!strncmp(dir, rules.table[i].source, rulesrc_len) && (dir[rulesrc_len] == '/' || dir[rulesrc_len] == '\0')) {
+			strcpy(path_buffer, rules.table[i].dest);
+			strcat(path_buffer, dir + rulesrc_len);
+			struct stat st;
+			if (stat(path_buffer, &st) || !S_ISDIR(st.st_mode)) {
+				// nothing to merge
+				continue;
+			}
+			*match = path_buffer;
+			return &rules.table[i];
+		}
+	}
+	*match = dir;
+	return NULL;
+}
+
+// Returns all kinds of access that at least one rule applies to
+enum rule_access rules_access() {
+	int access = 0;
+	for (size_t i = 0; i < rules.size; ++i) {
+		access |= rules.table[i].access;
+	}
+	return access;
+}
+
+// Returns true if pid is one of the ancestors
+static bool is_ancestor(pid_t pid, const pid_t *ancestors, size_t ancestors_size) {
+	for (size_t i = 0; i < ancestors_size; ++i) {
+		if (ancestors[i] == pid) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Returns the bitmask of all rules that apply to a task running the executable exe with the command name comm
+// ancestors contains the pid of the task itself followed by the pids of its parent processes
+rule_index_t rules_index(const char *exe, const char *comm, const pid_t *ancestors, size_t ancestors_size) {
+	rule_index_t index = 0;
+	for (size_t i = 0; i < rules.size; ++i) {
+		const struct section_t *section = &sections.table[rules.table[i].section];
+		if ((section->exe == NULL || (exe != NULL && !strcmp(section->exe, exe)))
+			&& (section->comm == NULL || (comm != NULL && !strcmp(section->comm, comm)))
+			&& (section->subtree == 0 || is_ancestor(section->subtree, ancestors, ancestors_size))) {
+			index |= (rule_index_t) 1 << i;
+		}
+	}
+	return index;
+}
+
+// Returns true if at least one rule is in a non-global section
+bool rules_have_sections() {
+	return rules.scoped != 0;
+}
+
+// Returns true if at least one section is limited to a process subtree
+bool rules_have_subtrees() {
+	for (size_t i = 1; i < sections.size; ++i) {
+		if (sections.table[i].subtree) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Returns true if at least one section depends on the executable, which changes with every exec
+bool rules_depend_on_exec() {
+	for (size_t i = 1; i < sections.size; ++i) {
+		if (sections.table[i].exe != NULL || sections.table[i].comm != NULL) {
+			return true;
+		}
+	}
 	return false;
 }
 
+// Returns true if at least one rule has the given mode
+bool rules_have_mode(enum rule_mode mode) {
+	for (size_t i = 0; i < rules.size; ++i) {
+		if (rules.table[i].mode == mode) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Returns the rule at position in the rule table, or NULL if there is none
+const struct rule_t *rules_at(size_t position) {
+	return position < rules.size ? &rules.table[position] : NULL;
+}
+
+// Replaces the destination of rule with a copy of dest, and remembers the one given in the rules
+void rule_set_dest(const struct rule_t *rule, const char *dest) {
+	const size_t i = rule_position(rule);
+	if (i < rules.size) {
+		if (rules.table[i].given_dest == NULL) {
+			rules.table[i].given_dest = rules.table[i].dest;
+		} else {
+			free((char *) rules.table[i].dest);
+		}
+		rules.table[i].dest = strdup(dest);
+	}
+}
+
+// Returns true if at least one rule has a latency budget
+// This is checked for every request, so it is kept up to date whenever rules are added or removed.
+bool rules_have_budgets() {
+	return rules.budgets;
+}
+
+// Returns the position of rule in the rule table, or MAX_RULES_SIZE if it is not part of it
+size_t rule_position(const struct rule_t *rule) {
+	if (rule < rules.table || rule >= rules.table + rules.size) {
+		return MAX_RULES_SIZE;
+	}
+	return rule - rules.table;
+}
+
+// Returns the load of rule, which the supervisor updates, or NULL if rule is not part of the rule table
+struct rule_load *rule_load(const struct rule_t *rule) {
+	const size_t i = rule_position(rule);
+	return i < rules.size ? &rules.table[i].load : NULL;
+}
+
 void init() {
 	copycat_env = getenv(COPYCAT_ENV);
 	if (copycat_env != NULL) {
-		parse_rules(copycat_env);
+		// parse a copy, the environment is inherited by child processes
+		char *rls = strdup(copycat_env);
+		parse_rules(rls);
+		free(rls);
 	} else {
 		// read config file instead
 		read_config();
@@ -141,5 +676,11 @@ void fini() {
 	for (size_t i = 0; i < rules.size; ++i) {
 		free((char *) rules.table[i].source);
 		free((char *) rules.table[i].dest);
+		free((char *) rules.table[i].given_dest);
+	}
+	for (size_t i = 0; i < sections.size; ++i) {
+		free((char *) sections.table[i].exe);
+		free((char *) sections.table[i].comm);
 	}
+	free(rules_text_buffer.text);
 }
@@ -9,15 +9,122 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <sys/param.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 
+#define READ_ONLY_PREFIX "ro:"
+#define WRITE_ONLY_PREFIX "wr:"
+#define ZSTD_PREFIX "zstd:"
+#define CACHE_PREFIX "cache:"
+#define UNION_PREFIX "union:"
+#define OVERLAY_PREFIX "overlay:"
+
+enum rule_mode {
+	// plain redirect to the destination
+	RULE_REDIRECT,
+	// the destination is zstd compressed and is served decompressed
+	RULE_ZSTD,
+	// the destination is on slow storage and is served from a local copy
+	RULE_CACHE,
+	// the source directory shows the content of both source and destination, where the destination takes precedence
+	RULE_UNION,
+	// like RULE_UNION, but the first write to a file of the source directory copies it to the destination, where all later opens find it
+	RULE_OVERLAY,
+};
+
+// the kind of access that a rule applies to
+enum rule_access {
+	// opens for reading, and querying files with stat() and friends
+	ACCESS_READ = 1,
+	// opens for writing, creating or truncating
+	ACCESS_WRITE = 2,
+	ACCESS_ANY = ACCESS_READ | ACCESS_WRITE,
+};
+
+// what happens to requests of a rule that would take longer than its latency budget
+enum rule_overload {
+	// the task opens the original path itself, as if there was no rule
+	OVERLOAD_FAIL_OPEN,
+	// the system call fails with EAGAIN
+	OVERLOAD_FAIL_CLOSED,
+};
+
+// trailing options of a rule line
+#define OPTION_BUDGET "budget="
+#define OPTION_FAIL_OPEN "fail-open"
+#define OPTION_FAIL_CLOSED "fail-closed"
+
+// a set of rules as bitmask over the rule table
+typedef uint64_t rule_index_t;
+#define RULE_INDEX_ALL (~(rule_index_t) 0)
+
+// a section of rules that only applies to some executables
+struct section_t {
+	// only applies to tasks running this executable, or to all if NULL
+	const char *exe;
+	// only applies to tasks with this command name, or to all if NULL
+	const char *comm;
+	// only applies to the process with this pid and its descendants, or to all if 0
+	pid_t subtree;
+};
+
+// the size of the rule and section tables at some point, see rules_mark()
+struct rules_mark_t {
+	size_t rules;
+	size_t sections;
+};
+
+// how a rule performed recently, as measured by the supervisor
+struct rule_load {
+	// moving average of the service time of requests of the rule
+	unsigned long long service_ns;
+	// the last time that a request was let through although the rule was over its budget
+	unsigned long long last_probe_ns;
+};
+
+struct rule_t {
+	const char *source;
+	const char *dest;
+	bool match_prefix;
+	bool replace_prefix_only;
+	enum rule_mode mode;
+	enum rule_access access;
+	// index into the section table, 0 is the global section
+	size_t section;
+	// the latency budget of a single request in nanoseconds, or 0 if there is none
+	unsigned long long budget_ns;
+	enum rule_overload overload;
+	struct rule_load load;
+	// the destination as given in the rules, if the supervisor replaced it since, or NULL
+	const char *given_dest;
+};
+
 void add_rule(char *source, char *destination);
+void parse_section(char *header);
 void parse_rule(char *line);
 void parse_rules(char *rls);
+bool parse_subtree_rules(char *rls, pid_t pid);
 void read_config();
-bool find_match(const char **match, const char *query);
+const char *rules_text();
+struct rules_mark_t rules_mark();
+void rules_rollback(struct rules_mark_t mark);
+void rules_remove_subtree(pid_t pid);
+const struct rule_t *find_match(const char **match, const char *query, enum rule_access access, rule_index_t index);
+const struct rule_t *find_union(const char **match, const char *dir, rule_index_t index);
+rule_index_t rules_index(const char *exe, const char *comm, const pid_t *ancestors, size_t ancestors_size);
+bool rules_have_sections();
+bool rules_have_subtrees();
+bool rules_depend_on_exec();
+enum rule_access rules_access();
+bool rules_have_mode(enum rule_mode mode);
+bool rules_have_budgets();
+size_t rule_position(const struct rule_t *rule);
+struct rule_load *rule_load(const struct rule_t *rule);
+const struct rule_t *rules_at(size_t position);
+void rule_set_dest(const struct rule_t *rule, const char *dest);
 
 void init() __attribute__((constructor));
 void fini() __attribute__((destructor));
@@ -0,0 +1,29 @@
+#pragma once
+
+/**
+ * The ABI for dynamic resolver plugins
+ *
+ * A resolver plugin is a shared library that is loaded with copycat --resolver /path/to/plugin.so
+ * and computes destinations at runtime, for paths that no static rule matches.
+ */
+
+#include <stddef.h>
+
+// the path is not redirected
+#define COPYCAT_RESOLVE_MISS 0
+// the path is redirected to the destination written to buf
+#define COPYCAT_RESOLVE_MATCH 1
+// may be or'ed to the result if the result for this path never changes, so that copycat can remember it
+#define COPYCAT_RESOLVE_CACHEABLE 2
+
+/**
+ * Resolves the destination of path
+ *
+ * path is absolute, unless the program opened a relative path that could not be resolved.
+ * On a match, the null-terminated destination must be written to buf, which has room for len bytes.
+ * Returns COPYCAT_RESOLVE_MISS or COPYCAT_RESOLVE_MATCH, optionally or'ed with COPYCAT_RESOLVE_CACHEABLE.
+ * A negative return value is treated as an uncacheable miss.
+ *
+ * This is called from the supervisor while the program waits for its system call, so it should return quickly.
+ */
+int copycat_resolve(const char *path, char *buf, size_t len);
@@ -0,0 +1,31 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "copycat_resolver.h"
+
+// the number of calls for the paths below is written to this file, so that the tests can check the memoisation
+#define CALLS_FILE "/tmp/resolver-calls"
+
+static unsigned long calls = 0;
+
+static void count_call() {
+	FILE *f = fopen(CALLS_FILE, "w");
+	if (f != NULL) {
+		fprintf(f, "%lu", ++calls);
+		fclose(f);
+	}
+}
+
+int copycat_resolve(const char *path, char *buf, size_t len) {
+	if (!strcmp(path, "/tmp/resolved-a")) {
+		count_call();
+		snprintf(buf, len, "/tmp/b");
+		return COPYCAT_RESOLVE_MATCH | COPYCAT_RESOLVE_CACHEABLE;
+	}
+	if (!strcmp(path, "/tmp/resolved-uncached")) {
+		count_call();
+		snprintf(buf, len, "/tmp/b");
+		return COPYCAT_RESOLVE_MATCH;
+	}
+	return COPYCAT_RESOLVE_MISS;
+}
@@ -2,7 +2,20 @@
 
 set -e
 
-COPYCAT="/tmp/a /tmp/b" copycat -- tests
+COPYCAT="/tmp/a /tmp/b
+/tmp/cached cache:/tmp/slow/b
+/tmp/link-a /tmp/link-b
+/tmp/rel-a b
+ro:/tmp/ro-a /tmp/b
+/tmp/union-src/ union:/tmp/union-dst/
+/tmp/overlay-src/ overlay:/tmp/overlay-dst/
+[comm=tests]
+/tmp/comm-a /tmp/b
+[comm=other]
+/tmp/comm-b /tmp/b
+[*]
+[exec=/usr/bin/ld]
+/tmp/invalid-a /tmp/b" copycat --cache-dir /tmp/copycat-cache --resolver build/tests/resolver_plugin.so -- tests "$(command -v copycat)"
 
 echo -e "\nRunning benchmark without interception:"
 benchmark
@@ -1,10 +1,18 @@
 #define _GNU_SOURCE
 
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <glob.h>
 #include <linux/openat2.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #define EXPECT(cond) if (!(cond)) { fprintf(stderr, "Failed assert: %s\n", #cond); exit(EXIT_FAILURE); }
@@ -25,28 +33,305 @@ void check_correct_fd(int fd) {
 	EXPECT(!a);
 }
 
-void setup() {
-	FILE *f = fopen("/tmp/b", "w");
+void write_b(const char *filename) {
+	FILE *f = fopen(filename, "w");
 	EXPECT(f);
 	fprintf(f, "b");
 	fclose(f);
 }
 
+void setup() {
+	write_b("/tmp/b");
+
+	// the original file must not exist, unlink is not intercepted
+	unlink("/tmp/a");
+	unlink("/tmp/link-b");
+	EXPECT(!symlink("b", "/tmp/link-b"));
+
+	// a zstd frame with the single raw block "b"
+	FILE *zst = fopen("/tmp/zstd-b.zst", "w");
+	EXPECT(zst);
+	fwrite("\x28\xb5\x2f\xfd\x20\x01\x09\x00\x00" "b", 1, 10, zst);
+	fclose(zst);
+
+	// a symlink to a directory that is not in /tmp
+	mkdir("/tmp/dotdot-dir", 0755);
+	mkdir("/tmp/dotdot-dir/sub", 0755);
+	unlink("/tmp/dotdot-link");
+	EXPECT(!symlink("dotdot-dir/sub", "/tmp/dotdot-link"));
+
+	// union directories
+	mkdir("/tmp/union-src", 0755);
+	mkdir("/tmp/union-dst", 0755);
+	write_b("/tmp/union-src/one");
+	write_b("/tmp/union-dst/two");
+	mkdir("/tmp/union-src/sub", 0755);
+	mkdir("/tmp/union-dst/sub", 0755);
+	write_b("/tmp/union-src/sub/three");
+	write_b("/tmp/union-dst/sub/four");
+	// only exists in the union, until its parent is moved out of it
+	rmdir("/tmp/fdc-moved/dir");
+	rmdir("/tmp/fdc-moved");
+	mkdir("/tmp/union-src/fdc", 0755);
+	mkdir("/tmp/union-src/fdc/dir", 0755);
+	mkdir("/tmp/union-dst/fdc", 0755);
+	mkdir("/tmp/union-dst/fdc/dir", 0755);
+	write_b("/tmp/union-dst/fdc/dir/f");
+
+	// stands in for a slow mount
+	mkdir("/tmp/slow", 0755);
+	write_b("/tmp/slow/b");
+
+	// writing to the overlay source would copy it up and renaming into it fails, so the original is written elsewhere and linked in,
+	// link is not intercepted. The overlay never modifies it, so it can be reused by later runs.
+	mkdir("/tmp/overlay-src", 0755);
+	struct stat st;
+	if (stat("/tmp/overlay-src/f", &st) < 0) {
+		write_b("/tmp/overlay-tmp");
+		EXPECT(!link("/tmp/overlay-tmp", "/tmp/overlay-src/f"));
+		unlink("/tmp/overlay-tmp");
+	}
+	unlink("/tmp/overlay-orig");
+	EXPECT(!link("/tmp/overlay-src/f", "/tmp/overlay-orig"));
+	mkdir("/tmp/overlay-src/sub", 0755);
+	if (stat("/tmp/overlay-src/sub/orig", &st) < 0) {
+		EXPECT(!link("/tmp/overlay-orig", "/tmp/overlay-src/sub/orig"));
+	}
+}
+
+// Returns true if listing the directory fd from the start contains name, fd is closed afterwards
+bool dir_has(int fd, const char *name) {
+	DIR *dir = fdopendir(fd);
+	EXPECT(dir);
+	rewinddir(dir);
+	bool found = false;
+	struct dirent *d;
+	while ((d = readdir(dir)) != NULL) {
+		found |= !strcmp(d->d_name, name);
+	}
+	closedir(dir);
+	return found;
+}
+
+/*
+ * Returns the path of name in the per-run directory of the overlay destination dst
+ * The supervisor, which is the parent of this process, creates it as run-PID-XXXXXX.
+ */
+const char *overlay_path(const char *dst, const char *name) {
+	static char path[PATH_MAX];
+	char pattern[PATH_MAX];
+	snprintf(pattern, sizeof(pattern), "%s/run-%d-*", dst, getppid());
+	glob_t g;
+	EXPECT(!glob(pattern, 0, NULL, &g) && g.gl_pathc == 1);
+	snprintf(path, sizeof(path), "%s/%s", g.gl_pathv[0], name);
+	globfree(&g);
+	return path;
+}
+
+void check_cached(const char *original) {
+	// the cache dir is passed to copycat on the command line
+	struct stat st, cst;
+	EXPECT(!stat(original, &st));
+	char cached[256];
+	snprintf(cached, sizeof(cached), "/tmp/copycat-cache/%lx-%lx", (unsigned long) st.st_dev, (unsigned long) st.st_ino);
+	EXPECT(!stat(cached, &cst));
+	EXPECT(cst.st_size == st.st_size);
+	EXPECT(cst.st_mtim.tv_sec == st.st_mtim.tv_sec && cst.st_mtim.tv_nsec == st.st_mtim.tv_nsec);
+	// the lock is only needed while filling the cache
+	strcat(cached, ".lock");
+	EXPECT(stat(cached, &cst) < 0);
+}
+
 int do_open(const char *filename) {
 	return open(filename, O_RDONLY);
 }
 
+// Returns the content of the file at path, which needs to be short
+const char *read_all(const char *path) {
+	static char buf[16];
+	int fd = do_open(path);
+	EXPECT(fd >= 0);
+	ssize_t len = read(fd, buf, sizeof(buf) - 1);
+	EXPECT(len >= 0);
+	buf[len] = '\0';
+	close(fd);
+	return buf;
+}
+
 int do_openat(const char *filename) {
 	return openat(0, filename, O_RDONLY);
 }
 
+int do_openat_relative(const char *dirname, const char *filename) {
+	int dirfd = open(dirname, O_RDONLY | O_DIRECTORY);
+	EXPECT(dirfd >= 0);
+	int fd = openat(dirfd, filename, O_RDONLY);
+	close(dirfd);
+	return fd;
+}
+
 int do_openat2(const char *filename) {
 	struct open_how how = {O_RDONLY, 0, 0};
 	return syscall(SYS_openat2, 0, filename, &how, sizeof(struct open_how));
 }
 
+/*
+ * Returns true if one of a few opens of path, whose rule has a budget that cannot be kept, fails with error
+ * Requests over budget are shed, except for a single probe once in a while, which may hit any of the opens.
+ */
+bool check_shed(const char *path, int flags, int error) {
+	for (size_t i = 0; i < 10; ++i) {
+		errno = 0;
+		int f = open(path, flags, 0644);
+		if (f < 0) {
+			return errno == error;
+		}
+		close(f);
+	}
+	return false;
+}
+
+/*
+ * Kills tasks while they open redirected files, so that some of them die while their request is served
+ * The supervisor has to keep serving everyone else.
+ */
+void check_killed() {
+	pid_t pids[16];
+	for (size_t i = 0; i < sizeof(pids) / sizeof(*pids); ++i) {
+		pids[i] = fork();
+		EXPECT(pids[i] >= 0);
+		if (pids[i] == 0) {
+			while (true) {
+				close(do_open("/tmp/a"));
+			}
+		}
+	}
+	usleep(10000);
+	for (size_t i = 0; i < sizeof(pids) / sizeof(*pids); ++i) {
+		kill(pids[i], SIGKILL);
+		EXPECT(waitpid(pids[i], NULL, 0) == pids[i]);
+	}
+	check_correct_fd(do_open("/tmp/a"));
+}
+
+/*
+ * Needs the descriptors of a task that is not a thread group leader, for a relative destination and for a union listing
+ */
+static void *thread_descriptors(void *arg) {
+	int dir = open("/tmp", O_RDONLY | O_DIRECTORY);
+	EXPECT(dir >= 0);
+	check_correct_fd(openat(dir, "/tmp/rel-a", O_RDONLY));
+	close(dir);
+	EXPECT(dir_has(open("/tmp/union-src", O_RDONLY | O_DIRECTORY), "two"));
+	return arg;
+}
+
+// Runs this test binary with the nested copycat instance at copycat, see main()
+void check_nested(const char *copycat, const char *self) {
+	pid_t pid = fork();
+	EXPECT(pid >= 0);
+	if (pid == 0) {
+		// sections match executables through symlinks
+		unlink("/tmp/tests-link");
+		EXPECT(!symlink(self, "/tmp/tests-link"));
+		// a wrapper inherits the rules of this instance, which the nested one hands over again
+		char rules[4096];
+		snprintf(rules, sizeof(rules), "%s\n[*]\n%s", getenv("COPYCAT"),
+			"/tmp/nested-a /tmp/b\n/tmp/nested-budget /tmp/b budget=0.000001 fail-closed\n[exe=/tmp/tests-link]\n/tmp/nested-exe /tmp/b");
+		setenv("COPYCAT", rules, 1);
+		execl(copycat, copycat, "--stats", "--", self, "--nested", NULL);
+		exit(EXIT_FAILURE);
+	}
+	int wstatus;
+	EXPECT(waitpid(pid, &wstatus, 0) == pid);
+	EXPECT(WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == EXIT_SUCCESS);
+}
+
+// the number of write opens in check_access_filter(), which is larger than the number of syscalls trapped otherwise
+#define ACCESS_FILTER_WRITES 1000
+
+/*
+ * Runs with only ro: rules, so that the filter lets the kernel handle all write opens without trapping them
+ * The test-access-filter test checks the --stats output to find out that they were not trapped.
+ */
+void check_access_filter() {
+	write_b("/tmp/b");
+	for (size_t i = 0; i < ACCESS_FILTER_WRITES; ++i) {
+		int f = open("/tmp/ro-only-a", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		EXPECT(f >= 0);
+		EXPECT(write(f, "a", 1) == 1);
+		close(f);
+	}
+	// the writes went to the original, and reads are still redirected
+	const char *content = read_all("/tmp/b");
+	EXPECT(!strcmp(content, "b"));
+	check_correct_fd(do_open("/tmp/ro-only-a"));
+	struct stat st;
+	EXPECT(!stat("/tmp/ro-only-a", &st));
+	EXPECT(!stat("/tmp/b", &st) && st.st_size == 1);
+	printf("Access filter tests passed!\n");
+}
+
+// the number of threads and opens per thread in check_burst()
+#define BURST_THREADS 16
+#define BURST_OPENS 200
+
+static void *burst_thread(void *path) {
+	for (size_t i = 0; i < BURST_OPENS; ++i) {
+		int f = do_open(path);
+		char c = 0;
+		EXPECT(f >= 0);
+		EXPECT(read(f, &c, 1) == 1 && c == 'b');
+		close(f);
+	}
+	return NULL;
+}
+
+/*
+ * Opens the redirected file path from many threads at once, so that the supervisor finds several notifications pending when it wakes up
+ * The test-burst test checks the --stats output for batches of more than one notification,
+ * and test-burst-budget for requests that were shed because of them. Those open the original path, which needs to read "b" as well.
+ */
+void check_burst(const char *path) {
+	write_b("/tmp/b");
+	pthread_t threads[BURST_THREADS];
+	for (size_t i = 0; i < BURST_THREADS; ++i) {
+		EXPECT(!pthread_create(&threads[i], NULL, burst_thread, (void *) path));
+	}
+	for (size_t i = 0; i < BURST_THREADS; ++i) {
+		EXPECT(!pthread_join(threads[i], NULL));
+	}
+	printf("Burst tests passed!\n");
+}
+
 int main(int argc, char *argv[])
 {
+	if (argc > 1 && !strcmp(argv[1], "--nested")) {
+		// running under a nested copycat instance, whose rules were taken over by the outer one
+		check_correct_fd(do_open("/tmp/nested-a"));
+		check_correct_fd(do_open("/tmp/nested-exe"));
+		// its budgets are enforced, too
+		EXPECT(check_shed("/tmp/nested-budget", O_RDONLY, EAGAIN));
+		// inherited overlay rules write to the overlay of the outer instance
+		write_b("/tmp/overlay-src/nested");
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && !strcmp(argv[1], "--burst")) {
+		unlink("/tmp/a");
+		check_burst("/tmp/a");
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && !strcmp(argv[1], "--burst-budget")) {
+		// the rule only applies to reads, so this writes the original
+		write_b("/tmp/burst-a");
+		check_burst("/tmp/burst-a");
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && !strcmp(argv[1], "--access-filter")) {
+		check_access_filter();
+		return EXIT_SUCCESS;
+	}
+
 	setup();
 
 	const char filename[] = "/tmp/a";
@@ -64,6 +349,217 @@ int main(int argc, char *argv[])
 	f = do_openat2(filename);
 	check_correct_fd(f);
 
+	// openat() relative to a dirfd
+	f = do_openat_relative("/tmp", "a");
+	check_correct_fd(f);
+
+	// relative destinations are opened relative to the dirfd of the task, which may be invalid
+	errno = 0;
+	EXPECT(openat(1000, "/tmp/rel-a", O_RDONLY) < 0 && errno == EBADF);
+	check_killed();
+
+	// bad pointers fail the syscall like they do without us, and the next request is still served
+	errno = 0;
+	EXPECT(syscall(SYS_openat, AT_FDCWD, (char *)1, O_RDONLY) < 0 && errno == EFAULT);
+	errno = 0;
+	EXPECT(syscall(SYS_openat2, AT_FDCWD, filename, (struct open_how *)1, sizeof(struct open_how)) < 0 && errno == EFAULT);
+	check_correct_fd(do_open(filename));
+
+	// open() relative to the current working directory
+	EXPECT(!chdir("/tmp"));
+	f = do_open("a");
+	check_correct_fd(f);
+	f = do_open("../tmp/./a");
+	check_correct_fd(f);
+	// ".." after a symlink leads to the parent of its target, which is not /tmp here
+	EXPECT(do_open("dotdot-link/../a") < 0);
+
+	// stat(), access() and readlink() see the redirected file, too
+	struct stat st, st_b;
+	EXPECT(!stat("/tmp/b", &st_b));
+	EXPECT(!stat(filename, &st));
+	EXPECT(st.st_ino == st_b.st_ino && st.st_size == 1);
+	EXPECT(!lstat(filename, &st));
+	EXPECT(st.st_ino == st_b.st_ino);
+	EXPECT(!fstatat(AT_FDCWD, "a", &st, 0));
+	EXPECT(st.st_ino == st_b.st_ino);
+	struct statx stx;
+	EXPECT(!statx(AT_FDCWD, filename, 0, STATX_INO, &stx));
+	EXPECT(stx.stx_ino == st_b.st_ino);
+	EXPECT(!access(filename, R_OK));
+	char target[16] = {0};
+	EXPECT(readlink("/tmp/link-a", target, sizeof(target)) == 1);
+	EXPECT(!strcmp(target, "b"));
+
+	// rules scoped to read-only access
+	unlink("/tmp/ro-a");
+	f = do_open("/tmp/ro-a");
+	check_correct_fd(f);
+	f = open("/tmp/ro-a", O_WRONLY | O_CREAT, 0644);
+	EXPECT(f >= 0);
+	EXPECT(write(f, "aa", 2) == 2);
+	EXPECT(!close(f));
+	EXPECT(!stat("/tmp/b", &st_b));
+	EXPECT(st_b.st_size == 1);
+
+	// listing a union directory shows the entries of both directories
+	DIR *dir = opendir("/tmp/union-src");
+	EXPECT(dir);
+	int entries = 0;
+	bool found_one = false, found_two = false;
+	struct dirent *d;
+	while ((d = readdir(dir)) != NULL) {
+		entries++;
+		found_one |= !strcmp(d->d_name, "one");
+		found_two |= !strcmp(d->d_name, "two");
+	}
+	EXPECT(found_one && found_two);
+	// the listing is served from the cache the second time
+	rewinddir(dir);
+	while (readdir(dir) != NULL) {
+		entries--;
+	}
+	EXPECT(entries == 0);
+	closedir(dir);
+	f = do_open("/tmp/union-src/two");
+	check_correct_fd(f);
+	// so do subdirectories that exist in both, whose entries can be opened relative to them
+	f = open("/tmp/union-src/sub", O_RDONLY | O_DIRECTORY);
+	EXPECT(f >= 0);
+	check_correct_fd(openat(f, "three", O_RDONLY));
+	check_correct_fd(openat(f, "four", O_RDONLY));
+	EXPECT(dir_has(dup(f), "three"));
+	EXPECT(dir_has(f, "four"));
+	// renaming the parent of a directory does not change the directory itself, but its descriptors no longer refer to the union
+	f = open("/tmp/union-src/fdc/dir", O_RDONLY | O_DIRECTORY);
+	EXPECT(f >= 0);
+	check_correct_fd(openat(f, "f", O_RDONLY));
+	EXPECT(!rename("/tmp/union-src/fdc", "/tmp/fdc-moved"));
+	errno = 0;
+	EXPECT(openat(f, "f", O_RDONLY) < 0 && errno == ENOENT);
+	close(f);
+	// threads share the descriptors of their process
+	pthread_t thread;
+	EXPECT(!pthread_create(&thread, NULL, thread_descriptors, NULL));
+	EXPECT(!pthread_join(thread, NULL));
+
+	// rules scoped to an executable only apply to tasks running it
+	f = do_open("/tmp/comm-a");
+	check_correct_fd(f);
+	unlink("/tmp/comm-b");
+	EXPECT(do_open("/tmp/comm-b") < 0);
+	// rules under an unknown section header are dropped instead of applying to everyone
+	unlink("/tmp/invalid-a");
+	EXPECT(do_open("/tmp/invalid-a") < 0);
+
+	// overlays copy files up on the first write only, into a directory for this run
+	check_correct_fd(do_open("/tmp/overlay-src/f"));
+	EXPECT(stat(overlay_path("/tmp/overlay-dst", "f"), &st) < 0);
+	f = open("/tmp/overlay-src/f", O_WRONLY | O_APPEND);
+	EXPECT(f >= 0);
+	EXPECT(write(f, "c", 1) == 1);
+	close(f);
+	EXPECT(!strcmp(read_all("/tmp/overlay-src/f"), "bc"));
+	EXPECT(!strcmp(read_all(overlay_path("/tmp/overlay-dst", "f")), "bc"));
+	EXPECT(!strcmp(read_all("/tmp/overlay-orig"), "b"));
+	f = open("/tmp/overlay-src/new", O_WRONLY | O_CREAT, 0644);
+	EXPECT(f >= 0);
+	close(f);
+	EXPECT(!stat(overlay_path("/tmp/overlay-dst", "new"), &st));
+	// originals can neither be removed nor moved nor replaced, but files that only exist in the overlay can be removed and moved
+	errno = 0;
+	EXPECT(unlink("/tmp/overlay-src/f") < 0 && errno == EROFS);
+	errno = 0;
+	EXPECT(rename("/tmp/overlay-src/f", "/tmp/overlay-moved") < 0 && errno == EROFS);
+	errno = 0;
+	EXPECT(rename("/tmp/b", "/tmp/overlay-src/b") < 0 && errno == EROFS);
+	errno = 0;
+	EXPECT(rename("/tmp/overlay-src/f", "/tmp/overlay-src/g") < 0 && errno == EROFS);
+	errno = 0;
+	EXPECT(rename("/tmp/overlay-src/new", "/tmp/overlay-src/f") < 0 && errno == EROFS);
+	EXPECT(!strcmp(read_all("/tmp/overlay-orig"), "b"));
+	EXPECT(!rename("/tmp/overlay-src/new", "/tmp/overlay-src/renamed"));
+	EXPECT(stat(overlay_path("/tmp/overlay-dst", "new"), &st) < 0);
+	EXPECT(!stat(overlay_path("/tmp/overlay-dst", "renamed"), &st));
+	EXPECT(!unlink("/tmp/overlay-src/renamed"));
+	EXPECT(stat(overlay_path("/tmp/overlay-dst", "renamed"), &st) < 0);
+	// writing into a subdirectory creates it in the overlay, but it still shows the originals next to the copies
+	f = open("/tmp/overlay-src/sub/x", O_WRONLY | O_CREAT, 0644);
+	EXPECT(f >= 0);
+	EXPECT(write(f, "b", 1) == 1);
+	close(f);
+	EXPECT(!stat(overlay_path("/tmp/overlay-dst", "sub/x"), &st));
+	f = open("/tmp/overlay-src/sub", O_RDONLY | O_DIRECTORY);
+	EXPECT(f >= 0);
+	check_correct_fd(openat(f, "orig", O_RDONLY));
+	check_correct_fd(openat(f, "x", O_RDONLY));
+	EXPECT(dir_has(dup(f), "orig"));
+	EXPECT(dir_has(f, "x"));
+
+	// destinations computed by the resolver plugin, which counts its calls in /tmp/resolver-calls
+	f = do_open("/tmp/resolved-a");
+	check_correct_fd(f);
+	f = do_open("/tmp/resolved-a");
+	check_correct_fd(f);
+	// the cacheable result was only computed once
+	EXPECT(!strcmp(read_all("/tmp/resolver-calls"), "1"));
+	check_correct_fd(do_open("/tmp/resolved-uncached"));
+	check_correct_fd(do_open("/tmp/resolved-uncached"));
+	EXPECT(!strcmp(read_all("/tmp/resolver-calls"), "3"));
+
+	const char *rules = getenv("COPYCAT");
+
+	// compressed destinations, only set up if copycat was built with zstd
+	if (rules != NULL && strstr(rules, "zstd:") != NULL) {
+		// the size is read from the frame header first, and from the cached content later
+		EXPECT(!stat("/tmp/zstd-a", &st));
+		EXPECT(st.st_size == 1);
+		check_correct_fd(do_open("/tmp/zstd-a"));
+		// the second open is served from the memfd cache
+		check_correct_fd(do_open("/tmp/zstd-a"));
+		EXPECT(!stat("/tmp/zstd-a", &st));
+		EXPECT(st.st_size == 1);
+		errno = 0;
+		EXPECT(open("/tmp/zstd-a", O_RDWR) < 0 && errno == EROFS);
+	}
+
+	// latency budgets, only set up by the test-budget test
+	if (rules != NULL && strstr(rules, "budget=") != NULL) {
+		check_correct_fd(do_open("/tmp/budget-a"));
+		// a budget of a nanosecond cannot be kept, so apart from the probes the rule is shed according to its policy
+		unlink("/tmp/budget-open");
+		EXPECT(check_shed("/tmp/budget-open", O_RDONLY, ENOENT));
+		EXPECT(check_shed("/tmp/budget-closed", O_RDONLY, EAGAIN));
+		// overlays never fail open, which would write to the original
+		mkdir("/tmp/overlay-budget", 0755);
+		EXPECT(check_shed("/tmp/overlay-budget/f", O_WRONLY | O_CREAT, EAGAIN));
+		// opening a FIFO blocks until there is a writer, but opens are cancelled once they run out of their budget
+		unlink("/tmp/fifo");
+		EXPECT(!mkfifo("/tmp/fifo", 0644));
+		errno = 0;
+		EXPECT(open("/tmp/budget-fifo-closed", O_RDONLY | O_CREAT, 0644) < 0 && errno == EAGAIN);
+		unlink("/tmp/budget-fifo-open");
+		EXPECT(!link("/tmp/b", "/tmp/budget-fifo-open"));
+		check_correct_fd(open("/tmp/budget-fifo-open", O_RDONLY | O_CREAT, 0644));
+	}
+
+	// read-through cache
+	f = do_open("/tmp/cached");
+	check_correct_fd(f);
+	check_cached("/tmp/slow/b");
+	f = do_open("/tmp/cached");
+	check_correct_fd(f);
+
+	// nested copycat instances hand their rules to this supervisor, they only apply to their own subtree
+	if (argc > 1) {
+		check_nested(argv[1], argv[0]);
+		unlink("/tmp/nested-a");
+		EXPECT(do_open("/tmp/nested-a") < 0);
+		check_correct_fd(do_open("/tmp/overlay-src/nested"));
+		EXPECT(!stat(overlay_path("/tmp/overlay-dst", "nested"), &st));
+		EXPECT(!unlink("/tmp/overlay-src/nested"));
+	}
+
 	printf("All tests passed!\n");
 	return EXIT_SUCCESS;
 }